@@ -0,0 +1,336 @@
+/*
+ * Microbenchmarks of the encode path of plotmsg.
+ *
+ * Usage: plotmsg_bench [--json] [--filter=<substring>] [--min-time-ms=<ms>] [--max-n=<n>]
+ *
+ * Every benchmark is repeated (with doubling iterations) until it ran for at least
+ * --min-time-ms. With --json, one JSON object per benchmark is written to stdout, such that
+ * the results can be compared between releases.
+ */
+#include "plotmsg/main.hpp"
+#include "plotmsg/template/core.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+// count every heap allocation, including those of protobuf
+static std::atomic<size_t> s_allocations{0};
+
+void *operator new(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+    struct Options
+    {
+        bool json = false;
+        std::string filter;
+        std::chrono::milliseconds min_time{200};
+        size_t max_n = 10000000;
+    };
+
+    Options options;
+
+    // keep the compiler from optimising value away
+    template <typename T>
+    void escape(T &&value)
+    {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    template <typename F>
+    void run(const std::string &name, size_t n, size_t bytes_per_op, F &&op)
+    {
+        const std::string full_name = name + "/" + std::to_string(n);
+        if (full_name.find(options.filter) == std::string::npos)
+            return;
+
+        using clock = std::chrono::steady_clock;
+        op();  // warm up
+        size_t iterations = 1;
+        double elapsed_ns;
+        size_t allocations;
+        while (true)
+        {
+            const size_t allocations_before = s_allocations.load();
+            const auto start = clock::now();
+            for (size_t i = 0; i < iterations; ++i)
+                op();
+            elapsed_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+            allocations = s_allocations.load() - allocations_before;
+            if (elapsed_ns >= std::chrono::nanoseconds(options.min_time).count() ||
+                iterations >= (size_t(1) << 30))
+                break;
+            iterations *= 2;
+        }
+
+        const double ns_per_op = elapsed_ns / iterations;
+        const double allocs_per_op = static_cast<double>(allocations) / iterations;
+        const double mb_per_sec = bytes_per_op / ns_per_op * 1e3;
+        if (options.json)
+        {
+            std::cout << "{\"name\": \"" << name << "\", \"n\": " << n
+                      << ", \"iterations\": " << iterations << ", \"ns_per_op\": " << ns_per_op
+                      << ", \"ops_per_sec\": " << 1e9 / ns_per_op
+                      << ", \"mb_per_sec\": " << mb_per_sec
+                      << ", \"allocs_per_op\": " << allocs_per_op << "}" << std::endl;
+        }
+        else
+        {
+            std::cout << std::left << std::setw(32) << full_name << std::right << std::setw(14)
+                      << std::fixed << std::setprecision(1) << ns_per_op << " ns/op"
+                      << std::setw(12) << mb_per_sec << " MB/s" << std::setw(12)
+                      << allocs_per_op << " allocs/op" << std::endl;
+        }
+    }
+
+    std::vector<size_t> sizes(size_t from)
+    {
+        std::vector<size_t> result;
+        for (size_t n = from; n <= options.max_n; n *= 10)
+            result.push_back(n);
+        return result;
+    }
+
+    std::vector<double> iota(size_t n)
+    {
+        std::vector<double> values(n);
+        for (size_t i = 0; i < n; ++i)
+            values[i] = 0.5 * i;
+        return values;
+    }
+
+    std::vector<std::pair<double, double>> pairs(size_t n)
+    {
+        std::vector<std::pair<double, double>> values(n);
+        for (size_t i = 0; i < n; ++i)
+            values[i] = {0.5 * i, 0.5 * i + 1};
+        return values;
+    }
+
+    void bench_dictionary()
+    {
+        for (size_t n : {10, 100, 1000})
+        {
+            std::vector<std::string> keys(n);
+            for (size_t i = 0; i < n; ++i)
+                keys[i] = "key_" + std::to_string(i);
+
+            run("dictionary_build", n, 0, [&] {
+                PlotMsg::Dictionary dict;
+                for (auto &&key : keys)
+                    dict[key] = 1.5;
+                escape(dict);
+            });
+
+            // series values, as deep_copy does not support every value type
+            const PlotMsg::Dictionary dict;
+            const auto series = iota(16);
+            for (auto &&key : keys)
+                dict[key] = series;
+            const size_t bytes = n * series.size() * sizeof(double);
+            run("dictionary_copy", n, bytes, [&] {
+                PlotMsg::Dictionary copy(dict);
+                escape(copy);
+            });
+            run("dictionary_deep_copy", n, bytes, [&] {
+                auto copy = dict.deep_copy();
+                escape(copy);
+            });
+        }
+    }
+
+    void bench_set_series()
+    {
+        for (size_t n : sizes(100))
+        {
+            const auto values = iota(n);
+            run("set_vector_double", n, n * sizeof(double), [&] {
+                PlotMsg::Dictionary dict;
+                dict["x"] = values;
+                escape(dict);
+            });
+
+            const std::vector<float> floats(values.begin(), values.end());
+            run("set_vector_float", n, n * sizeof(float), [&] {
+                PlotMsg::Dictionary dict;
+                dict["x"] = floats;
+                escape(dict);
+            });
+        }
+    }
+
+    void bench_templates()
+    {
+        for (size_t n : sizes(100))
+        {
+            const auto x = iota(n);
+            const auto y = iota(n);
+            run("trace_scatter", n, 2 * n * sizeof(double), [&] {
+                auto trace = PlotMsg::TraceTemplate::scatter(x, y);
+                escape(trace);
+            });
+            run("trace_vertices", n, 2 * n * sizeof(double), [&] {
+                auto trace = PlotMsg::TraceTemplate::vertices(x, y);
+                escape(trace);
+            });
+
+            const auto edges = pairs(n);
+            run("trace_edges", n, 4 * n * sizeof(double), [&] {
+                auto trace = PlotMsg::TraceTemplate::edges(edges, edges);
+                escape(trace);
+            });
+        }
+    }
+
+    void bench_figure()
+    {
+        // a PUB socket without subscribers drops every message
+        PlotMsg::initialise_publisher(0, "inproc://plotmsg-bench");
+
+        for (size_t n : sizes(100))
+        {
+            const auto x = iota(n);
+            const auto y = iota(n);
+
+            PlotMsg::Figure fig;
+            fig.add_trace(PlotMsg::TraceTemplate::scatter(x, y));
+            run("figure_copy", n, 2 * n * sizeof(double), [&] {
+                auto copy = fig.copy();
+                escape(copy);
+            });
+
+            // the series are only referred to by the copy
+            PlotMsg::Figure shared_fig;
+            auto trace = PlotMsg::TraceTemplate::scatter();
+            trace["x"] = PlotMsg::shared_series(x);
+            trace["y"] = PlotMsg::shared_series(y);
+            shared_fig.add_trace(trace);
+            run("figure_copy_shared", n, 2 * n * sizeof(double), [&] {
+                auto copy = shared_fig.copy();
+                escape(copy);
+            });
+
+            // includes building the trace, as send() resets the figure
+            run("figure_send", n, 2 * n * sizeof(double), [&] {
+                PlotMsg::Figure fig("bench");
+                fig.add_trace(PlotMsg::TraceTemplate::scatter(x, y));
+                fig.send();
+            });
+
+            // the same on a figure that reuses its arena, taking over a trace built on the heap
+            PlotMsg::Figure arena_fig("bench_arena", true);
+            run("figure_send_arena", n, 2 * n * sizeof(double), [&] {
+                arena_fig.add_trace(PlotMsg::TraceTemplate::scatter(x, y));
+                arena_fig.send();
+            });
+
+            // overwrites the series of the last frame in place
+            PlotMsg::Figure persistent("bench_persistent");
+            persistent.set_persistent();
+            persistent.add_trace(PlotMsg::TraceTemplate::scatter(x, y));
+            run("figure_send_persistent", n, 2 * n * sizeof(double), [&] {
+                persistent.trace(0)["x"] = x;
+                persistent.trace(0)["y"] = y;
+                persistent.send();
+            });
+
+            // serialising the traces of a figure on the sending thread, and on every core
+            PlotMsgProto::MessageContainer many;
+            const size_t num_traces = 32;
+            for (size_t t = 0; t < num_traces; ++t)
+            {
+                auto &data = *many.mutable_fig()->add_traces()->mutable_kwargs()->mutable_data();
+                PlotMsg::_set_DictItemVal(data["x"], x);
+                PlotMsg::_set_DictItemVal(data["y"], y);
+            }
+            const auto saved_options = PlotMsg::static_publisher_options;
+            PlotMsg::static_publisher_options.parallel_encode_threshold = 0;
+            for (size_t threads : {1, 0})
+            {
+                PlotMsg::static_publisher_options.parallel_encode_threads = threads;
+                run(threads == 1 ? "figure_encode_traces_serial" : "figure_encode_traces_parallel",
+                    n, num_traces * 2 * n * sizeof(double), [&] {
+                        auto frames = PlotMsg::encode_message(many);
+                        escape(frames);
+                    });
+            }
+            PlotMsg::static_publisher_options = saved_options;
+        }
+
+        // many small traces, built on the heap and on the arena of the figure
+        const size_t num_small = 256;
+        const auto small = iota(16);
+        for (bool use_arena : {false, true})
+        {
+            PlotMsg::Figure many_fig("bench_many_traces", use_arena);
+            run(use_arena ? "figure_send_traces_arena" : "figure_send_traces_heap", num_small,
+                num_small * 2 * small.size() * sizeof(double), [&] {
+                    for (size_t t = 0; t < num_small; ++t)
+                    {
+                        auto &trace = many_fig.emplace_trace(
+                            PlotMsgProto::PlotlyTrace::graph_objects, "Scatter"
+                        );
+                        trace["x"] = small;
+                        trace["y"] = small;
+                    }
+                    many_fig.send();
+                });
+        }
+    }
+}  // namespace
+
+int main(int argc, char const *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        auto value_of = [&arg](const char *flag) -> const char * {
+            const size_t len = std::strlen(flag);
+            return arg.compare(0, len, flag) == 0 ? arg.c_str() + len : nullptr;
+        };
+        if (arg == "--json")
+            options.json = true;
+        else if (auto value = value_of("--filter="))
+            options.filter = value;
+        else if (auto value = value_of("--min-time-ms="))
+            options.min_time = std::chrono::milliseconds(std::atoll(value));
+        else if (auto value = value_of("--max-n="))
+            options.max_n = static_cast<size_t>(std::atof(value));
+        else
+        {
+            std::cerr << "usage: " << argv[0]
+                      << " [--json] [--filter=<substring>] [--min-time-ms=<ms>] [--max-n=<n>]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    bench_dictionary();
+    bench_set_series();
+    bench_templates();
+    bench_figure();
+    return 0;
+}
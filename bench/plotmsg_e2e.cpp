@@ -0,0 +1,323 @@
+/*
+ * End-to-end latency and throughput of plotmsg, from the publisher to a C++ subscriber that
+ * decodes every MessageContainer.
+ *
+ * Usage: plotmsg_e2e [--json] [--transports=tcp,ipc,inproc] [--sizes=1e3,1e6,...]
+ *                    [--messages=<n>] [--budget-bytes=<n>] [--port=<port>]
+ *
+ * As the publisher is bound once per process, every transport runs in a forked child. The
+ * subscriber runs on a thread of that child (sharing its zmq context, for inproc), and
+ * the latency is measured from just before publishing a message to after decoding it.
+ * Messages are published back to back, once with dontwait and once blocking.
+ */
+#include "plotmsg/main.hpp"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        bool json = false;
+        std::vector<std::string> transports{"tcp", "ipc", "inproc"};
+        std::vector<size_t> sizes{1000, 64000, 1000000, 16000000, 500000000};
+        size_t messages = 1000;
+        // fewer messages are sent of large sizes, such that each run sends about this much
+        size_t budget_bytes = 2000000000;
+        int port = 5599;
+    };
+
+    Options options;
+
+    double now_ns()
+    {
+        return std::chrono::duration<double, std::nano>(clock::now().time_since_epoch()).count();
+    }
+
+    class Subscriber
+    {
+        /*
+         * Receives and decodes every message, and records its latency (from the "t_ns" key
+         * of the message) until stopped.
+         */
+    public:
+        explicit Subscriber(const std::string &addr)
+          : m_socket(*PlotMsg::static_context, ZMQ_SUB)
+        {
+            m_socket.set(zmq::sockopt::rcvtimeo, 50);
+            m_socket.set(zmq::sockopt::subscribe, "");
+            m_socket.connect(addr);
+            m_thread = std::thread(&Subscriber::run, this);
+        }
+
+        ~Subscriber()
+        {
+            m_stop.store(true);
+            m_thread.join();
+        }
+
+        size_t received() const
+        {
+            return m_received.load();
+        }
+
+        // wait until no message arrived for the given time
+        void drain(std::chrono::milliseconds idle)
+        {
+            size_t received = m_received.load();
+            while (true)
+            {
+                std::this_thread::sleep_for(idle);
+                if (m_received.load() == received)
+                    return;
+                received = m_received.load();
+            }
+        }
+
+        // take the recorded latencies (in ns), and the bytes and time of the last message
+        void collect(std::vector<double> &latencies, size_t &num_bytes, double &last_ns)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            latencies.swap(m_latencies);
+            m_latencies.clear();
+            num_bytes = m_bytes;
+            m_bytes = 0;
+            last_ns = m_last_ns;
+        }
+
+    private:
+        void run()
+        {
+            std::vector<zmq::message_t> frames;
+            PlotMsgProto::MessageContainer msg;
+            while (!m_stop.load())
+            {
+                frames.clear();
+                frames.emplace_back();
+                if (!m_socket.recv(frames.back()))
+                    continue;
+                while (frames.back().more())
+                {
+                    frames.emplace_back();
+                    (void)m_socket.recv(frames.back());
+                }
+
+                msg.ParseFromArray(frames[0].data(), static_cast<int>(frames[0].size()));
+                const double received_ns = now_ns();
+                size_t num_bytes = 0;
+                for (auto &&frame : frames)
+                    num_bytes += frame.size();
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_latencies.push_back(received_ns - msg.dict().data().at("t_ns").double_());
+                m_bytes += num_bytes;
+                m_last_ns = received_ns;
+                m_received.fetch_add(1);
+            }
+        }
+
+        zmq::socket_t m_socket;
+        std::thread m_thread;
+        std::atomic<bool> m_stop{false};
+        std::atomic<size_t> m_received{0};
+        std::mutex m_mutex;
+        std::vector<double> m_latencies;
+        size_t m_bytes = 0;
+        double m_last_ns = 0;
+    };
+
+    double percentile(std::vector<double> &sorted, double p)
+    {
+        if (sorted.empty())
+            return 0;
+        return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+    }
+
+    void report(
+        const std::string &transport, size_t size, const char *flags, size_t sent,
+        std::vector<double> &latencies, double mb_per_sec
+    )
+    {
+        std::sort(latencies.begin(), latencies.end());
+        const double drop_rate = sent == 0 ? 0 : 1 - static_cast<double>(latencies.size()) / sent;
+        const double p50 = percentile(latencies, 0.5) / 1e3;
+        const double p99 = percentile(latencies, 0.99) / 1e3;
+        const double p999 = percentile(latencies, 0.999) / 1e3;
+        if (options.json)
+        {
+            std::cout << "{\"transport\": \"" << transport << "\", \"size\": " << size
+                      << ", \"send_flags\": \"" << flags << "\", \"sent\": " << sent
+                      << ", \"received\": " << latencies.size() << ", \"drop_rate\": " << drop_rate
+                      << ", \"p50_us\": " << p50 << ", \"p99_us\": " << p99
+                      << ", \"p999_us\": " << p999 << ", \"mb_per_sec\": " << mb_per_sec << "}"
+                      << std::endl;
+        }
+        else
+        {
+            std::cout << std::left << std::setw(8) << transport << std::right << std::setw(11)
+                      << size << std::setw(10) << flags << std::fixed << std::setprecision(1)
+                      << std::setw(8) << sent << std::setw(9) << drop_rate * 100 << "%"
+                      << std::setw(12) << p50 << std::setw(12) << p99 << std::setw(12) << p999
+                      << std::setw(12) << mb_per_sec << std::endl;
+        }
+    }
+
+    void run_transport(const std::string &transport)
+    {
+        std::string addr;
+        if (transport == "tcp")
+            addr = "tcp://127.0.0.1:" + std::to_string(options.port);
+        else if (transport == "ipc")
+            addr = "ipc:///tmp/plotmsg-e2e-" + std::to_string(getpid());
+        else if (transport == "inproc")
+            addr = "inproc://plotmsg-e2e";
+        else
+        {
+            std::cerr << "unknown transport " << transport << std::endl;
+            return;
+        }
+
+        PlotMsg::initialise_publisher(0, addr);
+        Subscriber subscriber(addr);
+        // publish probes until the subscriber has joined (slow joiner)
+        const auto deadline = clock::now() + std::chrono::seconds(5);
+        while (subscriber.received() == 0)
+        {
+            if (clock::now() > deadline)
+            {
+                std::cerr << transport << ": the subscriber did not connect" << std::endl;
+                return;
+            }
+            PlotMsgProto::MessageContainer probe;
+            PlotMsg::_set_DictItemVal((*probe.mutable_dict()->mutable_data())["t_ns"], now_ns());
+            PlotMsg::publish_message(probe, zmq::send_flags::dontwait);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        subscriber.drain(std::chrono::milliseconds(100));
+        {
+            std::vector<double> probes;
+            size_t num_bytes;
+            double last_ns;
+            subscriber.collect(probes, num_bytes, last_ns);
+        }
+
+        for (size_t size : options.sizes)
+        {
+            const std::vector<uint8_t> payload(size, 7);
+            const size_t count =
+                std::max<size_t>(3, std::min(options.messages, options.budget_bytes / size));
+            for (auto flags : {zmq::send_flags::dontwait, zmq::send_flags::none})
+            {
+                const double start_ns = now_ns();
+                for (size_t i = 0; i < count; ++i)
+                {
+                    PlotMsgProto::MessageContainer msg;
+                    auto &data = *msg.mutable_dict()->mutable_data();
+                    PlotMsg::_set_DictItemVal(data["payload"], payload);
+                    PlotMsg::_set_DictItemVal(data["t_ns"], now_ns());
+                    PlotMsg::publish_message(msg, flags);
+                }
+                subscriber.drain(std::chrono::milliseconds(200));
+
+                std::vector<double> latencies;
+                size_t num_bytes;
+                double last_ns;
+                subscriber.collect(latencies, num_bytes, last_ns);
+                const double mb_per_sec =
+                    latencies.empty() ? 0 : num_bytes / ((last_ns - start_ns) / 1e9) / 1e6;
+                report(
+                    transport, size, flags == zmq::send_flags::dontwait ? "dontwait" : "blocking",
+                    count, latencies, mb_per_sec
+                );
+            }
+        }
+    }
+
+    template <typename T, typename F>
+    std::vector<T> split(const std::string &list, F &&parse)
+    {
+        std::vector<T> result;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ','))
+            result.push_back(parse(item));
+        return result;
+    }
+}  // namespace
+
+int main(int argc, char const *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        auto value_of = [&arg](const char *flag) -> const char * {
+            const size_t len = std::strlen(flag);
+            return arg.compare(0, len, flag) == 0 ? arg.c_str() + len : nullptr;
+        };
+        if (arg == "--json")
+            options.json = true;
+        else if (auto value = value_of("--transports="))
+            options.transports =
+                split<std::string>(value, [](const std::string &item) { return item; });
+        else if (auto value = value_of("--sizes="))
+            options.sizes = split<size_t>(value, [](const std::string &item) {
+                return static_cast<size_t>(std::atof(item.c_str()));
+            });
+        else if (auto value = value_of("--messages="))
+            options.messages = static_cast<size_t>(std::atof(value));
+        else if (auto value = value_of("--budget-bytes="))
+            options.budget_bytes = static_cast<size_t>(std::atof(value));
+        else if (auto value = value_of("--port="))
+            options.port = std::atoi(value);
+        else
+        {
+            std::cerr << "usage: " << argv[0]
+                      << " [--json] [--transports=tcp,ipc,inproc] [--sizes=1e3,1e6,...]"
+                         " [--messages=<n>] [--budget-bytes=<n>] [--port=<port>]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    if (!options.json)
+        std::cout << std::left << std::setw(8) << "proto" << std::right << std::setw(11)
+                  << "bytes" << std::setw(10) << "flags" << std::setw(8) << "sent"
+                  << std::setw(10) << "dropped" << std::setw(12) << "p50_us" << std::setw(12)
+                  << "p99_us" << std::setw(12) << "p999_us" << std::setw(12) << "MB/s"
+                  << std::endl;
+
+    for (auto &&transport : options.transports)
+    {
+        // a fresh process for every transport, as the publisher binds once per process
+        std::cout.flush();
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            run_transport(transport);
+            std::cout.flush();
+            std::_Exit(0);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (transport == "ipc")
+            std::remove(("/tmp/plotmsg-e2e-" + std::to_string(pid)).c_str());
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 import asyncio
+import struct
 import time
 
 try:
@@ -28,6 +29,109 @@ PLOTMSG_MODE_DEFAULT = "default"
 PLOTMSG_MODE_ASYNC = "async"
 PLOTMSG_MODE_WIDGET = "ipywidget"
 
+# codecs of compressed payloads (see `PublisherOptions::compression_codec`)
+PLOTMSG_CODEC_ZSTD = 1
+PLOTMSG_CODEC_LZ4 = 2
+# header of a compressed payload: a zero marker, codec, num_chunks, raw_size and chunk_size
+PLOTMSG_COMPRESSED_HEADER = struct.Struct("<xBxxIQI")
+
+
+def decompress_payload(payload):
+    """Decompress a payload frame that starts with the header of a compressed payload."""
+    codec, num_chunks, raw_size, chunk_size = PLOTMSG_COMPRESSED_HEADER.unpack_from(payload)
+    if codec == PLOTMSG_CODEC_ZSTD:
+        import zstandard
+
+        decompressor = zstandard.ZstdDecompressor()
+
+        def decompress(chunk, size):
+            return decompressor.decompress(chunk, max_output_size=size)
+
+    elif codec == PLOTMSG_CODEC_LZ4:
+        import lz4.block
+
+        def decompress(chunk, size):
+            return lz4.block.decompress(chunk, uncompressed_size=size)
+
+    else:
+        raise ValueError(f"Unknown codec {codec} of a compressed payload.")
+
+    sizes = struct.unpack_from(f"<{num_chunks}I", payload, PLOTMSG_COMPRESSED_HEADER.size)
+    offset = PLOTMSG_COMPRESSED_HEADER.size + 4 * num_chunks
+    out = bytearray(raw_size)
+    for i, size in enumerate(sizes):
+        start = i * chunk_size
+        end = min(start + chunk_size, raw_size)
+        out[start:end] = decompress(payload[offset : offset + size], end - start)
+        offset += size
+    return bytes(out)
+
+
+# topic frame in front of the payload (see `PublisherOptions::topic_frames`): b"fig/<uuid>\0"
+# for figures and b"dict\0" for dictionaries, whereas a protobuf payload never starts with
+# "f" or "d"
+PLOTMSG_DICT_TOPIC = b"dict\0"
+
+
+def figure_topic(uuid, prefix=False):
+    """The topic of the figure with the given uuid, or of every uuid that starts with it."""
+    topic = b"fig/" + uuid.encode()
+    return topic if prefix else topic + b"\0"
+
+
+# header of the shared-memory ring of a publisher (see `PublisherOptions::shm_threshold`):
+# a magic number, the capacity of the ring and its write position
+PLOTMSG_SHM_HEADER = struct.Struct("<QQQ")
+PLOTMSG_SHM_MAGIC = 0x314D485347534D50
+
+# mapped shared-memory rings, by name: (inode, mmap)
+_shm_regions = {}
+
+
+def map_shm_region(name):
+    """Map the shared-memory ring of a publisher on the same host (read-only).
+
+    The mapping is kept for the following messages, unless the ring was re-created
+    (e.g. by a restarted publisher of the same name)."""
+    import mmap
+    import os
+
+    path = "/dev/shm/" + name.lstrip("/")
+    inode = os.stat(path).st_ino
+    cached = _shm_regions.get(name)
+    if cached is not None and cached[0] == inode:
+        return cached[1]
+    fd = os.open(path, os.O_RDONLY)
+    try:
+        region = mmap.mmap(fd, 0, prot=mmap.PROT_READ)
+    finally:
+        os.close(fd)
+    if PLOTMSG_SHM_HEADER.unpack_from(region)[0] != PLOTMSG_SHM_MAGIC:
+        raise ValueError(f"'{path}' is not a plotmsg shared-memory ring.")
+    _shm_regions[name] = (inode, region)
+    return region
+
+
+def shm_series_intact(region, generation):
+    """Whether the ring has not wrapped around the series that was written at generation."""
+    _, capacity, write_pos = PLOTMSG_SHM_HEADER.unpack_from(region)
+    return write_pos <= generation + capacity
+
+
+# numpy dtype of the raw series payload that is carried in separate frames
+PLOTMSG_DTYPES = {
+    msg_pb2.DTYPE_FLOAT64: np.dtype("<f8"),
+    msg_pb2.DTYPE_INT32: np.dtype("<i4"),
+    msg_pb2.DTYPE_FLOAT32: np.dtype("<f4"),
+    msg_pb2.DTYPE_INT64: np.dtype("<i8"),
+    msg_pb2.DTYPE_INT16: np.dtype("<i2"),
+    msg_pb2.DTYPE_INT8: np.dtype("i1"),
+    msg_pb2.DTYPE_UINT64: np.dtype("<u8"),
+    msg_pb2.DTYPE_UINT32: np.dtype("<u4"),
+    msg_pb2.DTYPE_UINT16: np.dtype("<u2"),
+    msg_pb2.DTYPE_UINT8: np.dtype("u1"),
+}
+
 
 # helper decorator to only execute ipywidget related code
 def ipywidget_mode(warn=False):
@@ -77,8 +181,26 @@ class DummyClass:
 class PlotMsgReciever:
     """A class that listen to message from cpp"""
 
-    def __init__(self, address=PLOTMSG_ADDRESS, ctx_mgr=None):
+    def __init__(
+        self,
+        address=PLOTMSG_ADDRESS,
+        ctx_mgr=None,
+        uuids=(),
+        uuid_prefixes=(),
+        copy_shm=False,
+    ):
+        """Receive every message, or only the figures of the given uuids and of the uuids
+        that start with one of uuid_prefixes, which requires the publisher to send topic
+        frames (see `PublisherOptions::topic_frames`).
+
+        With copy_shm, the series in shared memory are copied out of the ring (see
+        `unpack_msg`), such that the received messages can be kept."""
         self.address = address
+        self.copy_shm = copy_shm
+        self.topics = [figure_topic(uuid) for uuid in uuids]
+        self.topics += [figure_topic(prefix, prefix=True) for prefix in uuid_prefixes]
+        if not self.topics:
+            self.topics = [b""]
         self.socket = None
         self.mode = None
         if ctx_mgr is None:
@@ -86,17 +208,73 @@ class PlotMsgReciever:
         self.ctx_mgr = ctx_mgr
 
     @staticmethod
-    def unpack_msg(msg):
-        """Recursive unpack method"""
+    def unpack_msg(msg, frames=(), copy_shm=False):
+        """Recursive unpack method
+
+        `frames` are the extra frames (after the protobuf payload) of a multipart
+        message, which carry the raw data of large series.
+
+        Series in the shared-memory ring of the publisher are read-only views of the
+        ring, which the publisher overwrites once the ring wraps around. Unless they are
+        copied (with `copy_shm`), they must not be kept beyond the processing of this
+        message.
+        """
+        # series that occur more than once in the message are unpacked once, such that
+        # every reference to them shares the same object
+        series_table = {}
+        # (region, generation) of the series in shared memory, which are checked to be
+        # intact once the whole message is unpacked
+        shm_series = []
+
+        def unpack_series_ref(index):
+            if index not in series_table:
+                series_table[index] = unpack(msg.series_table[index])
+            return series_table[index]
 
         def unpack(inputs):
             inputs_t = type(inputs)
             if inputs_t is msg_pb2.DictionaryMsg:
                 return {k: unpack(v) for (k, v) in inputs.data.items()}
             if inputs_t is msg_pb2.DictItemValMsg:
-                return unpack(getattr(inputs, inputs.WhichOneof("value")))
+                which = inputs.WhichOneof("value")
+                if which == "series_ref":
+                    return unpack_series_ref(inputs.series_ref)
+                return unpack(getattr(inputs, which))
             elif inputs_t in (msg_pb2.SeriesIMsg, msg_pb2.SeriesDMsg):
                 return np.array(inputs.data)
+            elif inputs_t is msg_pb2.SeriesFrameMsg:
+                # zero-copy view of the frame that holds the data
+                frame = frames[inputs.frame]
+                array = np.frombuffer(frame.buffer, dtype=PLOTMSG_DTYPES[inputs.dtype])
+                return array.reshape(tuple(inputs.shape)) if inputs.shape else array
+            elif inputs_t is msg_pb2.SeriesShmMsg:
+                # zero-copy view of the shared-memory ring
+                region = map_shm_region(inputs.region)
+                shm_series.append((region, inputs.generation))
+                dtype = PLOTMSG_DTYPES[inputs.dtype]
+                array = np.frombuffer(
+                    region, dtype=dtype, count=inputs.size // dtype.itemsize, offset=inputs.offset
+                )
+                if copy_shm:
+                    # (checked to be intact after the copy, along with the view)
+                    array = array.copy()
+                return array.reshape(tuple(inputs.shape)) if inputs.shape else array
+            elif inputs_t is msg_pb2.NDArrayMsg:
+                shape = tuple(inputs.shape)
+                if inputs.dtype == msg_pb2.DTYPE_BOOL:
+                    bits = np.frombuffer(inputs.data, dtype=np.uint8)
+                    array = np.unpackbits(bits, count=int(np.prod(shape)), bitorder="little")
+                    return array.astype(bool).reshape(shape)
+                # the raw bytes are viewed as a shaped array, without per-element conversion
+                array = np.frombuffer(inputs.data, dtype=PLOTMSG_DTYPES[inputs.dtype])
+                return array.reshape(shape)
+            elif inputs_t is msg_pb2.SegmentsMsg:
+                # rebuild the NaN separators between the (first, second) endpoints
+                endpoints = unpack(inputs.endpoints).reshape(-1, 2)
+                dtype = np.result_type(endpoints.dtype, np.float32)
+                series = np.full((len(endpoints), 3), np.nan, dtype=dtype)
+                series[:, :2] = endpoints
+                return series.ravel()
             elif inputs_t is msg_pb2.SeriesStringMsg:
                 return list(inputs.data)
             elif inputs_t is msg_pb2.SeriesAnyMsg:
@@ -119,7 +297,16 @@ class PlotMsgReciever:
             elif inputs_t == msg_pb2.PlotlyFigureMsg:
                 return dict(
                     uuid=inputs.uuid,
+                    patch=inputs.patch,
                     traces=[unpack(t) for t in inputs.traces],
+                    extends=[
+                        dict(
+                            trace=ext.trace,
+                            data=unpack(ext.data),
+                            max_points=ext.max_points,
+                        )
+                        for ext in inputs.extends
+                    ],
                     commands=[
                         dict(func=cmd.func, kwargs=unpack(cmd.kwargs))
                         for cmd in inputs.commands
@@ -128,7 +315,13 @@ class PlotMsgReciever:
             else:
                 raise RuntimeError("Unrecognised type {}".format(inputs_t))
 
-        return unpack(getattr(msg, msg.WhichOneof("message")))
+        result = unpack(getattr(msg, msg.WhichOneof("message")))
+        if not all(shm_series_intact(*series) for series in shm_series):
+            raise RuntimeError(
+                "A series in shared memory was overwritten before it was read, increase "
+                "PublisherOptions::shm_size."
+            )
+        return result
 
     # noinspection PyUnresolvedReferences
     def initialise(self, sleep=1, mode=PLOTMSG_MODE_DEFAULT):
@@ -143,20 +336,33 @@ class PlotMsgReciever:
         self.mode = mode
         socket = context.socket(zmq.SUB)
         socket.connect(self.address)
-        socket.setsockopt_string(zmq.SUBSCRIBE, "")
+        for topic in self.topics:
+            socket.setsockopt(zmq.SUBSCRIBE, topic)
         self.socket = socket
         time.sleep(sleep)
 
-    def _get_msg(self, encoded_msg):
+    def _get_msg(self, frames):
+        """Decode the frames of a (multipart) message.
+
+        The first frame is the protobuf payload (possibly compressed, see
+        `PublisherOptions::compression_codec`), and any following frames hold the
+        raw data of large series (see `PublisherOptions::multipart_threshold`). A topic
+        frame in front of them (see `PublisherOptions::topic_frames`) is skipped."""
+        if len(frames) > 1 and bytes(frames[0].buffer[:1]) in (b"f", b"d"):
+            frames = frames[1:]
+        payload = frames[0].bytes
+        # a raw protobuf payload never starts with a zero byte
+        if payload[:1] == b"\x00":
+            payload = decompress_payload(payload)
         msg = msg_pb2.MessageContainer()
-        msg.ParseFromString(encoded_msg)
-        return self.unpack_msg(msg)  # uuid, fig_kwargs
+        msg.ParseFromString(payload)
+        return self.unpack_msg(msg, frames[1:], self.copy_shm)  # uuid, fig_kwargs
 
     def get_msg_func(self, flags=0):
         """Return a function that process the incoming encoded msg"""
         self.initialise(mode=PLOTMSG_MODE_DEFAULT)
-        encoded_msg = self.socket.recv(flags=flags)
-        return lambda: self._get_msg(encoded_msg)
+        frames = self.socket.recv_multipart(flags=flags, copy=False)
+        return lambda: self._get_msg(frames)
 
     def get_msg(self, flags=0):
         return self.get_msg_func(flags)()
@@ -164,8 +370,8 @@ class PlotMsgReciever:
     async def get_msg_async_func(self):
         """Return a function that process the incoming encoded msg, asyncly"""
         self.initialise(mode=PLOTMSG_MODE_ASYNC)
-        encoded_msg = await self.socket.recv()
-        return lambda: self._get_msg(encoded_msg)
+        frames = await self.socket.recv_multipart(copy=False)
+        return lambda: self._get_msg(frames)
 
     async def get_msg_async(self):
         return (await self.get_msg_async_func())()
@@ -238,13 +444,18 @@ class PlotMsgPlotly:
         mode: str = PLOTMSG_MODE_WIDGET,
         initialise: bool = True,
         figure_type=None,
+        uuids=(),
+        uuid_prefixes=(),
     ):
         # the stored figs is a singleton
         if not hasattr(self.__class__, "stored_figs"):
             self.__class__.stored_figs = {}
             self.__class__.stored_msgs = []
+            self.__class__.stored_fig_states = {}
         self.figs = self.__class__.stored_figs
         self.msgs = self.__class__.stored_msgs
+        # the (patched) msg that each fig was last built from, keyed by uuid
+        self.fig_states = self.__class__.stored_fig_states
         self.hist_num_msgs = 0
 
         if mode == PLOTMSG_MODE_WIDGET:
@@ -255,13 +466,21 @@ class PlotMsgPlotly:
         if mode.startswith(PLOTMSG_MODE_WIDGET):
             mode = PLOTMSG_MODE_WIDGET
             self._initialise_as_ipywidgets()
+            # the msgs and fig states are kept (and patched or extended later on), hence
+            # they must not view the shared-memory ring
             self.reciever = PlotMsgReciever(
-                address=address, ctx_mgr=self.ctx_mgr_info_label
+                address=address,
+                ctx_mgr=self.ctx_mgr_info_label,
+                uuids=uuids,
+                uuid_prefixes=uuid_prefixes,
+                copy_shm=True,
             )
             self.goFigClass = go.FigureWidget
 
         elif mode == PLOTMSG_MODE_DEFAULT:
-            self.reciever = PlotMsgReciever(address=address)
+            self.reciever = PlotMsgReciever(
+                address=address, uuids=uuids, uuid_prefixes=uuid_prefixes, copy_shm=True
+            )
             self.ctx_mgr_chained = DummyCtxMgr
             self.ctx_mgr_pbar = DummyClass()
             self.goFigClass = go.Figure
@@ -436,8 +655,37 @@ class PlotMsgPlotly:
         if "uuid" not in msg:
             # not a fig message
             return
-        traces = []
         uuid = msg["uuid"]
+        if msg["extends"] and not msg["traces"]:
+            # only carries the samples appended to the series of the stored fig
+            state = self.fig_states.get(uuid)
+            if state is None:
+                return
+            changed = self._extend_series(state, msg["extends"])
+            msg = self._apply_patch(
+                dict(
+                    uuid=uuid,
+                    traces=[dict(kwargs=kwargs) for kwargs in changed],
+                    commands=msg["commands"],
+                )
+            )
+            if msg is None:
+                return
+        elif msg["patch"]:
+            msg = self._apply_patch(msg)
+            if msg is None:
+                return
+        # copied, such that patches do not alter the stored msgs
+        extends = msg["extends"]
+        msg = dict(
+            msg,
+            extends=[],
+            traces=[dict(t, kwargs=dict(t["kwargs"])) for t in msg["traces"]],
+        )
+        # extends sent along with whole traces apply on top of them
+        self._extend_series(msg, extends)
+        self.fig_states[uuid] = msg
+        traces = []
         # setup progress bar widget
         self.ctx_mgr_pbar.start(len(msg["traces"]))
         for t in msg["traces"]:
@@ -479,6 +727,55 @@ class PlotMsgPlotly:
         if self.mode == PLOTMSG_MODE_DEFAULT:
             plotly_fig.show()
 
+    @staticmethod
+    def _extend_series(state, extends):
+        """Append the samples of extend msgs to the series of the traces of a fig state,
+        keeping only the last max_points of each, and return the extended kwargs of each
+        trace."""
+        changed = [dict() for _ in state["traces"]]
+        for ext in extends:
+            kwargs = state["traces"][ext["trace"]]["kwargs"]
+            for key, points in ext["data"].items():
+                series = np.concatenate(
+                    [np.asarray(kwargs.get(key, ())), np.asarray(points)]
+                )
+                if ext["max_points"] > 0:
+                    series = series[-ext["max_points"] :]
+                kwargs[key] = changed[ext["trace"]][key] = series
+        return changed
+
+    def _apply_patch(self, patch):
+        """Apply the changed kwargs of a patch msg on top of the stored state of its fig.
+
+        Returns the patched msg if the figure has to be rebuilt, or None if it was
+        updated in place (or there is nothing to patch yet)."""
+        state = self.fig_states.get(patch["uuid"])
+        if state is None or len(state["traces"]) != len(patch["traces"]):
+            # e.g. subscribed after the last full frame, wait for the next one
+            return None
+        for stored, changed in zip(state["traces"], patch["traces"]):
+            stored["kwargs"].update(changed["kwargs"])
+        if patch["commands"]:
+            state["commands"] = patch["commands"]
+
+        fig = self.figs.get(patch["uuid"])
+        # graph_objects are the only traces that map one-to-one to the plotly traces
+        if (
+            fig is None
+            or len(fig.data) != len(state["traces"])
+            or any(t["method"] != "graph_objects" for t in state["traces"])
+        ):
+            return state
+        with fig.batch_update():
+            for trace, changed in zip(fig.data, patch["traces"]):
+                if changed["kwargs"]:
+                    trace.update(**changed["kwargs"])
+            for cmd in patch["commands"]:
+                getattr(fig, cmd["func"])(**cmd["kwargs"])
+        self.msgs[-1][0] = True
+        self._update_selection()
+        return None
+
     def spin_once(self, verbose=False):
         """spin once to process all pending messsages"""
         # noinspection PyTypeChecker,PyUnresolvedReferences
@@ -19,9 +19,13 @@ setuptools.setup(
     install_requires=[
         "protobuf>=4.0",
         "plotly",
-        "zmq",
+        "pyzmq",
         "ipython",
     ],
+    extras_require={
+        # decompression of compressed payloads
+        "compression": ["zstandard", "lz4"],
+    },
     classifiers=[
         "Programming Language :: Python :: 3",
         "License :: OSI Approved :: MIT License",
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace PlotMsg
+{
+    /*
+     * A bounded lock-free queue that supports multiple producers and consumers, following
+     * D. Vyukov's design. Each slot carries a sequence number that tells producers whether
+     * the slot is free to be written to, and consumers whether it is ready to be read from.
+     */
+    template <typename T>
+    class BoundedQueue
+    {
+    public:
+        // the capacity is rounded up to a power of two
+        explicit BoundedQueue(size_t capacity)
+        {
+            size_t size = 2;
+            while (size < capacity)
+                size <<= 1;
+            m_mask = size - 1;
+            m_cells.reset(new Cell[size]);
+            for (size_t i = 0; i < size; ++i)
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        BoundedQueue(const BoundedQueue &) = delete;
+
+        BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+        // moves value into the queue, unless the queue is full
+        bool try_push(T &value)
+        {
+            Cell *cell;
+            size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                cell = &m_cells[pos & m_mask];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (m_enqueue_pos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed
+                        ))
+                        break;
+                }
+                else if (diff < 0)
+                    return false;
+                else
+                    pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+            cell->value = std::move(value);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // moves the oldest item out of the queue, unless the queue is empty
+        bool try_pop(T &value)
+        {
+            Cell *cell;
+            size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            while (true)
+            {
+                cell = &m_cells[pos & m_mask];
+                size_t seq = cell->sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+                if (diff == 0)
+                {
+                    if (m_dequeue_pos.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed
+                        ))
+                        break;
+                }
+                else if (diff < 0)
+                    return false;
+                else
+                    pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+            value = std::move(cell->value);
+            cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+            return true;
+        }
+
+        // number of queued items (only a snapshot when used concurrently)
+        size_t size_approx() const
+        {
+            size_t enqueued = m_enqueue_pos.load(std::memory_order_relaxed);
+            size_t dequeued = m_dequeue_pos.load(std::memory_order_relaxed);
+            return enqueued > dequeued ? enqueued - dequeued : 0;
+        }
+
+        size_t capacity() const
+        {
+            return m_mask + 1;
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<Cell[]> m_cells;
+        size_t m_mask;
+        // keep the producer and consumer positions on separate cache lines
+        alignas(64) std::atomic<size_t> m_enqueue_pos{0};
+        alignas(64) std::atomic<size_t> m_dequeue_pos{0};
+    };
+}  // namespace PlotMsg
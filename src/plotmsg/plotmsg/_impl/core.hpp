@@ -4,7 +4,14 @@
 
 #include <zmq.hpp>
 
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
 #define PLOTMSG_DEFAULT_ADDR "tcp://127.0.0.1:5557"
+// address that the per-thread sockets push into when publishing from multiple threads
+#define PLOTMSG_FAN_IN_ADDR "inproc://plotmsg-fan-in"
 
 #if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
 // C++17 specific
@@ -21,13 +28,199 @@ namespace PlotMsg
     // easy alias
     using DictionaryMsgData = google::protobuf::Map<std::string, PlotMsgProto::DictItemValMsg>;
 
+    // the arrays of the shared series that a message refers to (see PlotMsg::shared_series),
+    // which have to be kept alive until the message is encoded
+    using SharedSeriesList = std::vector<std::shared_ptr<const PlotMsgProto::NDArrayMsg>>;
+
+    // what send_async does when the queue of the background publisher is full
+    enum class OverflowPolicy
+    {
+        block,        // wait for the publisher thread to make room
+        drop_oldest,  // discard the oldest queued message
+        drop_newest,  // discard the message that is being queued
+    };
+
+    // codec that compresses the protobuf payload of a message (the value is sent on the wire)
+    enum class Codec : uint8_t
+    {
+        none = 0,
+        zstd = 1,  // requires plotmsg to be built with zstd
+        lz4 = 2,   // requires plotmsg to be built with lz4
+    };
+
+    // options that control how messages are encoded and published. Persistent figures (see
+    // Figure::set_persistent) only keep their traces while messages are published in place,
+    // i.e. without multipart_threshold, shm_threshold, delta_updates, dedup_series,
+    // conflate/max_rate_hz and send_async (without multi_producer), which take the message
+    // apart. With any of those, a persistent figure starts over after each send() like any
+    // other, rather than publishing a deep copy of every frame.
+    struct PublisherOptions
+    {
+        // Series whose payload is at least this many bytes are moved out of the protobuf
+        // message and handed to zmq as separate frames of a multipart message, without
+        // being copied. Zero disables the multipart path (single frame messages).
+        size_t multipart_threshold = 0;
+
+        // For subscribers on the same host: series whose payload is at least this many bytes
+        // are copied into a POSIX shared-memory ring of shm_size bytes (named shm_name, or
+        // "/plotmsg-<pid>" if empty), and the message only carries where they are. The ring
+        // is overwritten as it wraps around, hence it has to hold every series that is in
+        // flight or still used by a subscriber. Zero disables the shared-memory path. The
+        // ring is created with the first such series, and unlinked at exit.
+        size_t shm_threshold = 0;
+        size_t shm_size = size_t(1) << 30;
+        std::string shm_name;
+
+        // capacity (rounded up to a power of two) of the queue of the background publisher,
+        // read when the publisher thread starts with the first send_async
+        size_t async_queue_size = 64;
+
+        OverflowPolicy async_overflow_policy = OverflowPolicy::block;
+
+        // Allow publishing from multiple threads. Each thread then sends through its own
+        // inproc PUSH socket, and a fan-in thread forwards the messages to the PUB socket
+        // (zmq sockets must not be shared between threads). Read by initialise_publisher.
+        bool multi_producer = false;
+
+        // Bind an XPUB socket that reports the subscriptions made to the publisher (see
+        // num_subscriptions), through the fan-in thread of multi_producer. initialise_publisher
+        // then waits for wait_for_subscriptions subscriptions (at most
+        // subscription_wait_timeout) instead of sleeping after bind. Subscriptions are counted
+        // per topic rather than per subscriber: a viewer that subscribes to several topics (see
+        // topic_frames) counts several times. Read by initialise_publisher.
+        bool track_subscribers = false;
+        size_t wait_for_subscriptions = 0;
+        std::chrono::milliseconds subscription_wait_timeout{1000};
+
+        // with track_subscribers, drop messages before they are encoded while nobody is
+        // subscribed
+        bool skip_without_subscribers = false;
+
+        // Send a topic frame in front of the payload of every message (see message_topic),
+        // such that subscribers can subscribe to the figures they show only, and zmq drops the
+        // other figures on the publisher side. With track_subscribers, has_listeners(uuid) and
+        // skip_without_subscribers then also tell the subscribed uuids apart.
+        bool topic_frames = false;
+
+        // Only send the keys of a figure's traces that changed since the last frame with the
+        // same uuid, as a patch that the subscriber applies on top of that frame. Frames whose
+        // traces were added, removed or recreated are sent whole, as is every
+        // delta_keyframe_interval-th frame (for subscribers that join late or missed a frame).
+        // Keys are compared byte for byte, hence a copy of the last frame of each uuid is kept.
+        bool delta_updates = false;
+        size_t delta_keyframe_interval = 100;
+
+        // Send the series that occur more than once in a message (e.g. the same x of several
+        // traces, or the same shared series) only once, and refer to them by index from each
+        // occurrence. Series are compared by content if they have at least dedup_min_bytes,
+        // and shared series by identity.
+        bool dedup_series = false;
+        size_t dedup_min_bytes = 1024;
+
+        // Conflate the figures that are sent faster than they can be published: a figure is
+        // held by the background publisher until its uuid is due, and a newer figure with the
+        // same uuid replaces the held one (latest value wins, see conflated_frames). With
+        // max_rate_hz > 0 (which implies conflate), each uuid is due at most max_rate_hz
+        // times per second. Figures that extend traces are never conflated.
+        bool conflate = false;
+        double max_rate_hz = 0;
+
+        // Serialise the traces of figure payloads of at least parallel_encode_threshold bytes
+        // on up to parallel_encode_threads threads (0 uses every core, 1 serialises them all
+        // on the sending thread), each straight into its place in the payload frame. The
+        // threads are shared with compression_threads, started by the first such payload and
+        // joined at exit.
+        size_t parallel_encode_threads = 1;
+        size_t parallel_encode_threshold = 1 << 20;
+
+        // Append every published message to the log file at record_path (empty disables it,
+        // an existing recording is appended to), with the time it was encoded and its figure uuid,
+        // such that it can be replayed with plotmsg_replay. The records are written by a
+        // background thread, which up to record_queue_size messages wait for (sending blocks
+        // beyond that). With record_only, messages are only recorded: the publisher does not
+        // bind a socket. Read by initialise_publisher.
+        std::string record_path;
+        size_t record_queue_size = 1024;
+        bool record_only = false;
+
+        // Compress the protobuf payload of messages that are at least compression_threshold
+        // bytes (smaller ones are sent raw). The payload is split into chunks of
+        // compression_chunk_size bytes, which are compressed by up to compression_threads
+        // threads (0 uses every core). compression_level is the zstd level, or the lz4
+        // acceleration. Frames split off by multipart_threshold are sent uncompressed.
+        Codec compression_codec = Codec::none;
+        int compression_level = 3;
+        size_t compression_threshold = 4096;
+        size_t compression_chunk_size = 1 << 20;
+        size_t compression_threads = 0;
+    };
+
     // define the static storage
     INLINE std::unique_ptr<zmq::context_t> static_context;
     INLINE std::unique_ptr<zmq::socket_t> static_publisher;
+    // defined by the library only, as its strings must not be destroyed by every module
+    extern PublisherOptions static_publisher_options;
+
+    // static functions (initialise_publisher is safe to call from multiple threads). The
+    // publisher is bound once: calling it again with another addr throws std::logic_error (also
+    // when a message was sent, or has_listeners called, before it, which bind the default addr)
+    void initialise_publisher(int sleep_after_bind, const std::string &addr);
+
+    void initialise_publisher(int sleep_after_bind = 1000, const char *addr = PLOTMSG_DEFAULT_ADDR);
+
+    // initialise_publisher() unless the publisher is up already (cheap then, hence called by
+    // every send)
+    void _ensure_publisher();
+
+    // with PublisherOptions::track_subscribers, the number of subscriptions (to any topic, not
+    // of distinct subscribers, which XPUB does not tell apart) currently made to
+    // the publisher (zero otherwise)
+    size_t num_subscriptions();
+
+#ifdef PLOTMSG_DISABLE
+    // plotting is compiled out, hence nobody listens (see the PLOTMSG_DISABLE cmake option)
+    inline bool has_listeners()
+    {
+        return false;
+    }
+
+    inline bool has_listeners(const std::string & /* uuid */)
+    {
+        return false;
+    }
+#else
+    // whether a published message might be received: with PublisherOptions::track_subscribers
+    // whether anybody is subscribed, and always true otherwise. Never blocks: the publisher is
+    // started in the background by the first call, and it is false until the publisher is up
+    bool has_listeners();
+
+    // whether a published figure of the given uuid might be received: with topic_frames and
+    // track_subscribers whether anybody subscribed to its topic, and has_listeners() otherwise
+    bool has_listeners(const std::string &uuid);
+#endif
+
+    // the topic frame of the given message with PublisherOptions::topic_frames: "fig/<uuid>\0"
+    // for figures (subscribe to "fig/<prefix>" for every uuid that starts with prefix) and
+    // "dict\0" for dictionaries
+    std::string message_topic(const PlotMsgProto::MessageContainer &msg);
+
+    // with PublisherOptions::track_subscribers, wait until at least n subscriptions are made,
+    // returns false if the timeout expired first
+    bool wait_for_subscriptions(size_t n, std::chrono::milliseconds timeout);
+
+    // encode the given message into zmq frames, following static_publisher_options
+    std::vector<zmq::message_t> encode_message(PlotMsgProto::MessageContainer &msg);
+
+    // publish the given (multipart) frames with the static publisher (or with the socket of
+    // the calling thread, see PublisherOptions::multi_producer), returns false if the frames
+    // were not queued by zmq (e.g. dontwait at the high-water mark)
+    bool publish_frames(std::vector<zmq::message_t> &frames, zmq::send_flags send_flags);
 
-    // static functions
-    void initialise_publisher(
-        int sleep_after_bind = 1000, const std::string &addr = PLOTMSG_DEFAULT_ADDR
+    // encode and publish the given message (through the background publisher if it runs),
+    // holding on to the shared series it refers to until it is encoded
+    bool publish_message(
+        PlotMsgProto::MessageContainer &msg, zmq::send_flags send_flags,
+        SharedSeriesList shared_series = {}
     );
 
     std::ostream &operator<<(std::ostream &out, DictionaryMsgData const &dict);
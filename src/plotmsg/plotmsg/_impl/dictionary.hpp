@@ -3,6 +3,7 @@
 #include "core.hpp"
 #include "helpers.hpp"
 #include "index_proxy_access.hpp"
+#include "publisher.hpp"
 
 namespace PlotMsg
 {
@@ -15,14 +16,18 @@ namespace PlotMsg
         {
         public:
             template <typename T>
-            DictionaryItemPair(const std::basic_string<char> &key, T value)
+            DictionaryItemPair(const std::basic_string<char> &key, T &&value)
             {
                 m_key = key;
+#ifndef PLOTMSG_DISABLE
+                PlotMsg::_hold_shared_series(m_shared_series, value);
                 PlotMsg::_set_DictItemVal(m_item_val, std::forward<T>(value));
+#endif
             }
 
             std::basic_string<char> m_key;
             DictItemValMsg m_item_val;
+            SharedSeriesList m_shared_series;
         };
 
         Dictionary()
@@ -30,18 +35,26 @@ namespace PlotMsg
             reset();
         }
 
-        // template to create dictionary with arbitrary amount of item pair
+        // dictionary whose message tree is allocated on the given arena
+        explicit Dictionary(google::protobuf::Arena *arena) : m_arena(arena)
+        {
+            reset();
+        }
+
+        // template to create dictionary with arbitrary amount of item pair (the values are
+        // forwarded, such that r-value series are moved rather than copied)
         template <typename T, typename... Types>
-        Dictionary(const std::basic_string<char> &key, T val, Types... rest) : Dictionary(rest...)
+        Dictionary(const std::basic_string<char> &key, T &&val, Types &&...rest)
+          : Dictionary(std::forward<Types>(rest)...)
         {
-            add_kwargs(key, val);
+            add_kwargs(key, std::forward<T>(val));
         }
 
         // template bases-case
         template <typename T>
-        Dictionary(const std::basic_string<char> &key, T val) : Dictionary()
+        Dictionary(const std::basic_string<char> &key, T &&val) : Dictionary()
         {
-            add_kwargs(key, val);
+            add_kwargs(key, std::forward<T>(val));
         }
 
         // template to create dictionary with dict item pair
@@ -52,16 +65,18 @@ namespace PlotMsg
 
         // template bases-case
         template <typename... Ts, typename = DictionaryItemPair>
-        explicit Dictionary(DictionaryItemPair pair, Ts... rest) : Dictionary(rest...)
+        explicit Dictionary(DictionaryItemPair pair, Ts &&...rest)
+          : Dictionary(std::forward<Ts>(rest)...)
         {
             add_kwargs(pair);
         }
 
-        // copy-construct
+        // copy-construct (shared series are referenced, not copied)
         Dictionary(const Dictionary &dict)
         {
             reset();
-            m_msg->ParseFromString(dict.m_msg->SerializeAsString());
+            m_msg->CopyFrom(*dict.m_msg);
+            m_shared_series = dict.m_shared_series;
         }
 
         // swap-construct
@@ -69,12 +84,16 @@ namespace PlotMsg
         {
             reset();
             m_msg.swap(dict.m_msg);
+            std::swap(m_arena, dict.m_arena);
+            m_shared_series.swap(dict.m_shared_series);
         }
 
         // rvalue-construct
         Dictionary(Dictionary &&dict) noexcept
         {
             m_msg = std::move(dict.m_msg);
+            m_arena = dict.m_arena;
+            m_shared_series = std::move(dict.m_shared_series);
         }
 
         //// ONLY ENABLE FOR CERTAIN CLASS
@@ -91,10 +110,13 @@ namespace PlotMsg
         // methods to add kwargs into the dictionary
 
         template <typename T>
-        void add_kwargs(const std::basic_string<char> &key, T value)
+        void add_kwargs(const std::basic_string<char> &key, T &&value)
         {
+#ifndef PLOTMSG_DISABLE
             // pass the DictItemValMsg reference to helper function as template
+            PlotMsg::_hold_shared_series(m_shared_series, value);
             PlotMsg::_set_DictItemVal((*m_msg->mutable_data())[key], std::forward<T>(value));
+#endif
         }
 
         void add_kwargs(DictionaryItemPair &value) const;
@@ -103,16 +125,17 @@ namespace PlotMsg
 
         void update_kwargs(Dictionary &&value) const;
 
-        // directly set kwargs
-        void set_kwargs(Dictionary &value) const;
+        // directly set kwargs (swapped with those of value, or taken over if value is on the
+        // heap while this dictionary is on an arena, such that they are not copied)
+        void set_kwargs(Dictionary &value);
 
-        void set_kwargs(Dictionary &&value) const;
+        void set_kwargs(Dictionary &&value);
 
         std::unique_ptr<Dictionary> deep_copy() const;
 
         IndexAccessProxy operator[](const std::basic_string<char> &key) const
         {
-            return IndexAccessProxy(*m_msg->mutable_data(), key);
+            return IndexAccessProxy(*m_msg->mutable_data(), key, m_shared_series);
         }
 
         ///////////////////////////////////////////////////
@@ -124,11 +147,16 @@ namespace PlotMsg
         DictionaryMsg *release_ptr();
 
         // variables
-        std::unique_ptr<DictionaryMsg> m_msg;
+        MessagePtr<DictionaryMsg> m_msg;
+        // arena that owns m_msg (null if it is heap allocated)
+        google::protobuf::Arena *m_arena = nullptr;
+        // the shared series that m_msg refers to (which are held until it is sent or reset)
+        mutable SharedSeriesList m_shared_series;
     };
 
     void Dictionary::add_kwargs(Dictionary::DictionaryItemPair &value) const
     {
+        _hold_shared_series(m_shared_series, value.m_shared_series);
         (*m_msg->mutable_data())[value.m_key].Swap(&value.m_item_val);
     }
 
@@ -144,33 +172,48 @@ namespace PlotMsg
      */
     void Dictionary::update_kwargs(Dictionary &value) const
     {
+        // the replaced items end up in value, so it keeps its shared series as well
+        _hold_shared_series(m_shared_series, value.m_shared_series);
         for (auto &kv_pair : (*value.m_msg->mutable_data()))
         {
             (*m_msg->mutable_data())[kv_pair.first].Swap(&kv_pair.second);
         }
     }
 
-    void Dictionary::set_kwargs(Dictionary &&value) const
+    void Dictionary::set_kwargs(Dictionary &&value)
     {
         Dictionary lvalue(value);
         set_kwargs(lvalue);
     }
 
-    void Dictionary::set_kwargs(Dictionary &value) const
+    void Dictionary::set_kwargs(Dictionary &value)
     {
+        if (m_msg->GetArena() != nullptr && value.m_msg->GetArena() == nullptr)
+        {
+            // swapping maps of different arenas would copy them, so take over the message of
+            // value instead (which is left empty)
+            m_msg = std::move(value.m_msg);
+            m_arena = nullptr;
+            m_shared_series.swap(value.m_shared_series);
+            value.reset();
+            return;
+        }
         m_msg->mutable_data()->swap(*value.m_msg->mutable_data());
+        m_shared_series.swap(value.m_shared_series);
     }
 
     std::unique_ptr<Dictionary> Dictionary::deep_copy() const
     {
         Dictionary dict;
         _deep_copy_helper(m_msg->data(), *dict.m_msg->mutable_data());
+        dict.m_shared_series = m_shared_series;
         return std::make_unique<Dictionary>(dict);
     }
 
     void Dictionary::reset()
     {
-        m_msg = std::make_unique<DictionaryMsg>();
+        m_msg.reset(google::protobuf::Arena::CreateMessage<DictionaryMsg>(m_arena));
+        m_shared_series.clear();
     }
 
     DictionaryMsg *Dictionary::release_ptr()
@@ -185,16 +228,32 @@ namespace PlotMsg
 
     void send(Dictionary &container, zmq::send_flags send_flags = zmq::send_flags::dontwait)
     {
-        initialise_publisher();
+        _ensure_publisher();
 
         MessageContainer msg;
-        msg.mutable_dict()->Swap(container.release_ptr());
+        msg.mutable_dict()->Swap(container.m_msg.get());
+        SharedSeriesList shared_series;
+        shared_series.swap(container.m_shared_series);
+        container.reset();
+
+        publish_message(msg, send_flags, std::move(shared_series));
+    }
+
+    // queue the dictionary to be encoded and sent by the background publisher thread
+    std::future<bool>
+    send_async(Dictionary &container, zmq::send_flags send_flags = zmq::send_flags::dontwait)
+    {
+        _ensure_publisher();
+
+        MessagePtr<MessageContainer> msg(new MessageContainer());
+        msg->mutable_dict()->Swap(container.m_msg.get());
+        SharedSeriesList shared_series;
+        shared_series.swap(container.m_shared_series);
+        container.reset();
 
-        std::string encoded_msg;
-        msg.SerializeToString(&encoded_msg);
-        zmq::message_t zmq_msg(encoded_msg.size());
-        memcpy((void *)zmq_msg.data(), encoded_msg.c_str(), encoded_msg.size());
-        static_publisher->send(zmq_msg, send_flags);
+        return publish_message_async(
+            std::move(msg), nullptr, send_flags, std::move(shared_series)
+        );
     }
 
 }  // namespace PlotMsg
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "helpers.hpp"
+#include "publisher.hpp"
 #include "trace.hpp"
 
 namespace PlotMsg
@@ -9,16 +10,51 @@ namespace PlotMsg
     class Figure
     {
     public:
-        explicit Figure(std::string uuid = "default") : m_uuid(std::move(uuid))
+        /**
+         * @param uuid identifier of the figure on the subscriber side
+         * @param use_arena allocate the message tree of each frame (figure, traces and their
+         *        kwargs) on a protobuf arena, which is released all at once by reset()
+         */
+        explicit Figure(std::string uuid = "default", bool use_arena = false)
+          : m_uuid(std::move(uuid))
         {
+            if (use_arena)
+                m_arena = std::make_shared<google::protobuf::Arena>();
             reset();
         }
 
+        Figure(const Figure &fig);
+
+        Figure(Figure &&fig) = default;
+
+        Figure &operator=(const Figure &fig);
+
+        Figure &operator=(Figure &&fig) noexcept;
+
+        ~Figure()
+        {
+            // everything that might live on the arena must go before the arena itself
+            m_traces.clear();
+            m_msg.reset();
+        }
+
         void set_uuid(const std::string &_uuid)
         {
             m_uuid = _uuid;
         }
 
+        /**
+         * Keep the traces across send() (persistent frames), instead of starting over with an
+         * empty figure. Each frame then overwrites the values of the last one in place, such
+         * that the trace slots, keys and the capacity of the series are reused. Commands and
+         * extends are still cleared by each send(). Use reset() to start over. Only takes
+         * effect while messages are published in place (see PublisherOptions).
+         */
+        void set_persistent(bool persistent = true)
+        {
+            m_persistent = persistent;
+        }
+
         void set_trace_kwargs(uint idx, PlotMsg::Dictionary &value);
 
         void add_trace(Trace &trace)
@@ -54,6 +90,17 @@ namespace PlotMsg
             add_trace(PlotMsg::Trace(std::forward<Ts>(args)...));
         }
 
+        // adds an empty trace whose kwargs live on the arena of the figure (if it has one), so
+        // that the series assigned to it are not copied once more when the figure is sent
+        Trace &emplace_trace(PlotlyTrace::CreationMethods method, std::string method_func)
+        {
+            _add_trace();
+            auto &trace = m_traces[size() - 1];
+            trace.m_method = method;
+            trace.m_method_func = std::move(method_func);
+            return trace;
+        }
+
         /*
         void add_trace(Dictionary &value);
 
@@ -73,7 +120,8 @@ namespace PlotMsg
             {
                 if (i == index)
                     continue;
-                m_traces.push_back(tmp_traces[i]);
+                // moved (together with the arena of its kwargs) rather than copied
+                m_traces.push_back(std::move(tmp_traces[i]));
             }
         }
 
@@ -90,6 +138,21 @@ namespace PlotMsg
             m_traces[idx].m_kwargs.add_kwargs(key, value);
         }
 
+        // append new_points to the series `key` of trace idx of the last frame that was sent
+        // with this uuid, keeping only the last max_points samples of each extended key of
+        // the trace (0 keeps them all); only the new samples are sent with the next send()
+        template <typename T>
+        void extend_trace(uint idx, const std::string &key, T &&new_points, size_t max_points = 0)
+        {
+#ifndef PLOTMSG_DISABLE
+            PlotMsg::_hold_shared_series(m_shared_series, new_points);
+            PlotMsg::_set_DictItemVal(
+                (*_extend_trace_msg(idx, max_points)->mutable_data()->mutable_data())[key],
+                std::forward<T>(new_points)
+            );
+#endif
+        }
+
         int _add_trace();
 
         void add_command(const std::string &func, Dictionary &value);
@@ -130,6 +193,22 @@ namespace PlotMsg
 
         void send(zmq::send_flags send_flags = zmq::send_flags::dontwait);
 
+        // hand the figure over to the background publisher thread, which encodes and sends it
+        // (see PlotMsg::publish_message_async), and reset this figure for the next frame
+        std::future<bool> send_async(zmq::send_flags send_flags = zmq::send_flags::dontwait);
+
+        // build the figure with build(*this) and send it, only if anybody listens to its uuid
+        // (see PlotMsg::has_listeners), such that its traces are not even built otherwise
+        template <typename F>
+        bool send_lazy(F &&build, zmq::send_flags send_flags = zmq::send_flags::dontwait)
+        {
+            if (!has_listeners(m_uuid))
+                return false;
+            std::forward<F>(build)(*this);
+            send(send_flags);
+            return true;
+        }
+
         void reset();
 
         friend std::ostream &operator<<(std::ostream &out, Figure const &fig);
@@ -137,10 +216,24 @@ namespace PlotMsg
         std::vector<Trace> m_traces;
 
     private:
-        zmq::message_t build_zmq_msg();
+        // move the kwargs of every trace into the message (reusing its trace slots), where
+        // kwargs on another arena than the message are lent to it (if they are unpacked again)
+        // or handed over to it
+        void _pack_traces(bool lend);
+
+        // move the kwargs back out of the message once it was sent, for the next frame
+        void _unpack_traces();
+
+        // the extend msg of trace idx in the pending message
+        ExtendTraceMsg *_extend_trace_msg(uint idx, size_t max_points);
 
         // variables
-        MessageContainer m_msg;
+        // shared with the frames that zmq still sends out of it (see send())
+        std::shared_ptr<google::protobuf::Arena> m_arena;
+        MessagePtr<MessageContainer> m_msg;
         std::string m_uuid;
+        // the shared series that m_msg refers to (the traces hold on to their own)
+        SharedSeriesList m_shared_series;
+        bool m_persistent = false;
     };
 }  // namespace PlotMsg
@@ -2,6 +2,13 @@
 
 #include "msg.pb.h"
 
+#include <memory>
+#include <type_traits>
+
+#ifdef WITH_EIGEN
+#include <Eigen/Core>
+#endif
+
 namespace PlotMsg
 {
 
@@ -10,13 +17,205 @@ namespace PlotMsg
     // forward declare
     class Dictionary;
 
-    SeriesDMsg *vec_to_allocated_seriesD(std::vector<double> value);
+    // deleter of protobuf messages, which skips messages that are owned by an arena (those
+    // are released all at once with their arena)
+    struct MessageDeleter
+    {
+        void operator()(google::protobuf::MessageLite *msg) const
+        {
+            if (msg->GetArena() == nullptr)
+                delete msg;
+        }
+    };
+
+    template <typename T>
+    using MessagePtr = std::unique_ptr<T, MessageDeleter>;
+
+    // the returned series are allocated on the given arena (or on the heap if it is null)
+    SeriesDMsg *vec_to_allocated_seriesD(
+        const std::vector<double> &value, google::protobuf::Arena *arena = nullptr
+    );
+
+    SeriesIMsg *
+    vec_to_allocated_seriesI(const std::vector<int> &value, google::protobuf::Arena *arena = nullptr);
+
+    // the string and any series take over the (moved) elements of the given vector
+
+    SeriesStringMsg *vec_to_allocated_seriesString(
+        std::vector<std::string> value, google::protobuf::Arena *arena = nullptr
+    );
+
+    SeriesAnyMsg *vec_to_allocated_seriesAny(
+        std::vector<SeriesAnyMsg_value> value, google::protobuf::Arena *arena = nullptr
+    );
+
+    constexpr DType _integral_dtype(size_t size, bool is_signed)
+    {
+        return size == 1   ? (is_signed ? DTYPE_INT8 : DTYPE_UINT8)
+               : size == 2 ? (is_signed ? DTYPE_INT16 : DTYPE_UINT16)
+               : size == 4 ? (is_signed ? DTYPE_INT32 : DTYPE_UINT32)
+                           : (is_signed ? DTYPE_INT64 : DTYPE_UINT64);
+    }
+
+    // element type of a raw (little-endian) payload that holds values of type T
+    template <typename T>
+    struct DTypeOf
+    {
+        static_assert(
+            std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && sizeof(T) <= 8,
+            "Unsupported element type (bool is bit-packed separately)"
+        );
+        static constexpr DType value =
+            std::is_floating_point<T>::value
+                ? (sizeof(T) == 4 ? DTYPE_FLOAT32 : DTYPE_FLOAT64)
+                : _integral_dtype(sizeof(T), std::is_signed<T>::value);
+    };
+
+    template <typename T>
+    constexpr DType DTypeOf<T>::value;
+
+    template <typename...>
+    using _void_t = void;
+
+    template <typename T>
+    struct _is_eigen_expression
+#ifdef WITH_EIGEN
+      : std::is_base_of<Eigen::EigenBase<T>, T>
+#else
+      : std::false_type
+#endif
+    {
+    };
+
+    // whether Range is a contiguous range of arithmetic values, i.e., it has data() and size()
+    // (std::vector, std::array, ...), other than std::string and Eigen expressions
+    template <typename Range, typename = void>
+    struct is_arithmetic_range : std::false_type
+    {
+    };
+
+    template <typename Range>
+    struct is_arithmetic_range<
+        Range, _void_t<
+                   decltype(std::declval<const Range &>().data()),
+                   decltype(std::declval<const Range &>().size())>>
+      : std::integral_constant<
+            bool, std::is_arithmetic<std::remove_cv_t<std::remove_pointer_t<
+                          decltype(std::declval<const Range &>().data())>>>::value &&
+                      !std::is_same<Range, std::string>::value &&
+                      !_is_eigen_expression<Range>::value>
+    {
+    };
+
+    /*
+     * A view of contiguous, row-major n-dimensional data (e.g. the z grid of a heatmap),
+     * which is sent as a shaped array. The data is not owned by the view, and is copied
+     * with a single memcpy when the view is assigned to a dictionary item.
+     */
+    template <typename T>
+    struct NDArray
+    {
+        const T *data;
+        std::vector<size_t> shape;
+
+        size_t num_elements() const
+        {
+            size_t num = 1;
+            for (auto &&dim : shape)
+                num *= dim;
+            return num;
+        }
+    };
+
+    template <typename T>
+    NDArray<T> ndarray(const T *data, std::vector<size_t> shape)
+    {
+        return {data, std::move(shape)};
+    }
+
+    template <typename T>
+    NDArray<T> ndarray(const std::vector<T> &data, std::vector<size_t> shape)
+    {
+        NDArray<T> array{data.data(), std::move(shape)};
+        if (array.num_elements() != data.size())
+            throw std::invalid_argument("Given shape does not match the number of elements.");
+        return array;
+    }
+
+    // a one-dimensional view of size values, starting at the given pointer
+    template <typename T>
+    NDArray<T> series(const T *data, size_t size)
+    {
+        return {data, {size}};
+    }
+
+    /*
+     * A view of line segments along one dimension, i.e., the (first, second) endpoints of
+     * each segment. They are sent packed, and the receiver separates the segments again.
+     */
+    template <typename T>
+    struct Segments
+    {
+        const std::pair<T, T> *data;
+        size_t size;
+        // halves the payload of double endpoints, at the cost of their precision
+        bool as_float32;
+    };
+
+    template <typename T>
+    Segments<T> segments(const std::vector<std::pair<T, T>> &pairs, bool as_float32 = false)
+    {
+        return {pairs.data(), pairs.size(), as_float32};
+    }
+
+    // the returned array holds a copy of num_bytes of the given raw data
+    NDArrayMsg *raw_to_allocated_ndarray(
+        DType dtype, const void *data, size_t num_bytes, const std::vector<size_t> &shape,
+        google::protobuf::Arena *arena = nullptr
+    );
+
+    /*
+     * An immutable series that is stored once, and shared (rather than copied) by every
+     * dictionary item that it is assigned to, and by the copies of those dictionaries, traces
+     * and figures. Assigning another value to one of those items only replaces that item.
+     */
+    struct SharedSeries
+    {
+        uint64_t id;
+        std::shared_ptr<const NDArrayMsg> array;
+    };
+
+    // takes over the given heap allocated array
+    SharedSeries _make_shared_series(NDArrayMsg *array);
+
+    // the shared series holds a copy of the given data
+    template <typename T>
+    SharedSeries shared_series(const NDArray<T> &value)
+    {
+        return _make_shared_series(raw_to_allocated_ndarray(
+            DTypeOf<T>::value, value.data, value.num_elements() * sizeof(T), value.shape
+        ));
+    }
+
+    template <typename Range, std::enable_if_t<is_arithmetic_range<Range>::value, int> = 0>
+    SharedSeries shared_series(const Range &value)
+    {
+        using T = std::remove_cv_t<std::remove_pointer_t<decltype(value.data())>>;
+        return shared_series(series<T>(value.data(), value.size()));
+    }
+
+    // keep the shared series that a value refers to alive in the given list (when the value is
+    // assigned to an item of the dictionary that owns the list), a no-op for other values
+    template <typename T>
+    void _hold_shared_series(SharedSeriesList & /* list */, const T & /* value */)
+    {
+    }
 
-    SeriesIMsg *vec_to_allocated_seriesI(std::vector<int> value);
+    void _hold_shared_series(SharedSeriesList &list, const SharedSeries &value);
 
-    SeriesStringMsg *vec_to_allocated_seriesString(std::vector<std::string> value);
+    void _hold_shared_series(SharedSeriesList &list, const SharedSeriesList &other);
 
-    SeriesAnyMsg *vec_to_allocated_seriesAny(std::vector<SeriesAnyMsg_value> value);
+    void _hold_shared_series(SharedSeriesList &list, const PlotMsg::Dictionary &value);
 
     // helper function to assign given DictItemValMsg with T value
     void _set_DictItemVal(DictItemValMsg &item_val, NullValueType null);
@@ -27,21 +226,135 @@ namespace PlotMsg
 
     void _set_DictItemVal(DictItemValMsg &item_val, int value);
 
-    template <typename T>
+    template <
+        typename T,
+        std::enable_if_t<std::is_constructible<std::string, T>::value, int> = 0>
     void _set_DictItemVal(DictItemValMsg &item_val, T value)
     {
         // this works for l/r-value std::string, and const char.
         item_val.set_string(std::forward<T>(value));
     }
 
+    // other arithmetic values (float, int64_t, ...) are stored as double, or as the smallest
+    // integer field that holds every value of their type
+    template <typename T, std::enable_if_t<std::is_arithmetic<T>::value, int> = 0>
+    void _set_DictItemVal(DictItemValMsg &item_val, T value)
+    {
+        if (std::is_floating_point<T>::value)
+            item_val.set_double_(static_cast<double>(value));
+        else if (sizeof(T) < sizeof(int32_t) ||
+                 (sizeof(T) == sizeof(int32_t) && std::is_signed<T>::value))
+            item_val.set_int_(static_cast<int32_t>(value));
+        else if (std::is_signed<T>::value || sizeof(T) < sizeof(int64_t))
+            item_val.set_int64(static_cast<int64_t>(value));
+        else
+            item_val.set_uint64(static_cast<uint64_t>(value));
+    }
+
     void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<double> &value);
 
     void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<int> &value);
 
     void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<std::string> &value);
 
+    void _set_DictItemVal(DictItemValMsg &item_val, std::vector<std::string> &&value);
+
     void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<SeriesAnyMsg_value> &value);
 
+    void _set_DictItemVal(DictItemValMsg &item_val, std::vector<SeriesAnyMsg_value> &&value);
+
+    // hand over a buffer that is already in the wire representation (swapped in, not copied)
+    void _set_DictItemVal(DictItemValMsg &item_val, google::protobuf::RepeatedField<double> &&value);
+
+    void _set_DictItemVal(DictItemValMsg &item_val, google::protobuf::RepeatedField<int32_t> &&value);
+
+    // write num_bytes of raw data into the array of item_val, overwriting an array that is
+    // already there in place (keeping the capacity of its buffers)
+    void _set_ndarray(
+        DictItemValMsg &item_val, DType dtype, const void *data, size_t num_bytes,
+        const size_t *shape, size_t ndim
+    );
+
+    template <typename T>
+    void _set_DictItemVal(DictItemValMsg &item_val, const NDArray<T> &value)
+    {
+        _set_ndarray(
+            item_val, DTypeOf<T>::value, value.data, value.num_elements() * sizeof(T),
+            value.shape.data(), value.shape.size()
+        );
+    }
+
+    template <typename S, typename T>
+    void _write_segment_endpoints(NDArrayMsg &endpoints, const Segments<T> &value)
+    {
+        endpoints.set_dtype(DTypeOf<S>::value);
+        endpoints.add_shape(value.size);
+        endpoints.add_shape(2);
+        auto *bytes = endpoints.mutable_data();
+        bytes->resize(value.size * 2 * sizeof(S));
+        auto *out = reinterpret_cast<S *>(&(*bytes)[0]);
+        for (size_t i = 0; i < value.size; ++i)
+        {
+            out[2 * i] = static_cast<S>(value.data[i].first);
+            out[2 * i + 1] = static_cast<S>(value.data[i].second);
+        }
+    }
+
+    template <typename T>
+    void _set_DictItemVal(DictItemValMsg &item_val, const Segments<T> &value)
+    {
+        auto *segments = google::protobuf::Arena::CreateMessage<SegmentsMsg>(item_val.GetArena());
+        if (value.as_float32)
+            _write_segment_endpoints<float>(*segments->mutable_endpoints(), value);
+        else
+            _write_segment_endpoints<T>(*segments->mutable_endpoints(), value);
+        item_val.set_allocated_segments(segments);
+    }
+
+    // bit-packed
+    void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<bool> &value);
+
+    // only refers to the shared series, which the owner of item_val has to hold on to
+    void _set_DictItemVal(DictItemValMsg &item_val, const SharedSeries &value);
+
+    // any other contiguous range of arithmetic values is sent in its native (packed) type
+    template <typename Range, std::enable_if_t<is_arithmetic_range<Range>::value, int> = 0>
+    void _set_DictItemVal(DictItemValMsg &item_val, const Range &value)
+    {
+        using T = std::remove_cv_t<std::remove_pointer_t<decltype(value.data())>>;
+        const size_t size = value.size();
+        _set_ndarray(item_val, DTypeOf<T>::value, value.data(), size * sizeof(T), &size, 1);
+    }
+
+#ifdef WITH_EIGEN
+    /*
+     * Any Eigen expression (matrix, vector, map or block, of any storage order and stride)
+     * is evaluated straight into the array payload. Vectors are sent as 1-D arrays, and
+     * everything else as (rows, cols) arrays in row-major order.
+     */
+    template <typename Derived>
+    void _set_DictItemVal(DictItemValMsg &item_val, const Eigen::DenseBase<Derived> &value)
+    {
+        using T = typename Derived::Scalar;
+        using RowMajorMatrix = Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+        auto *array = google::protobuf::Arena::CreateMessage<NDArrayMsg>(item_val.GetArena());
+        array->set_dtype(DTypeOf<T>::value);
+        if (Derived::IsVectorAtCompileTime)
+            array->add_shape(value.size());
+        else
+        {
+            array->add_shape(value.rows());
+            array->add_shape(value.cols());
+        }
+        auto *bytes = array->mutable_data();
+        bytes->resize(value.size() * sizeof(T));
+        Eigen::Map<RowMajorMatrix>(reinterpret_cast<T *>(&(*bytes)[0]), value.rows(), value.cols()) =
+            value.derived();
+        item_val.set_allocated_ndarray(array);
+    }
+#endif
+
     void _set_DictItemVal(DictItemValMsg &item_val, PlotMsg::Dictionary &value);
 
     // r-value, uses l-value definition
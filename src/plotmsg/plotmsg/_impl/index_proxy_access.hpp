@@ -11,29 +11,33 @@ namespace PlotMsg
          */
         PlotMsg::DictionaryMsgData &ref_data;
         std::string m_key;
+        // the shared series held by the dictionary that owns ref_data
+        PlotMsg::SharedSeriesList &m_shared_series;
 
-        IndexAccessProxy(PlotMsg::DictionaryMsgData &ref_data, std::string key)
-          : ref_data(ref_data), m_key(std::move(key))
+        IndexAccessProxy(
+            PlotMsg::DictionaryMsgData &ref_data, std::string key,
+            PlotMsg::SharedSeriesList &shared_series
+        )
+          : ref_data(ref_data), m_key(std::move(key)), m_shared_series(shared_series)
         {
         }
 
+        // l-values are copied, and r-values are moved where the series type allows it
         template <typename T>
-        IndexAccessProxy &operator=(T &other)
+        IndexAccessProxy &operator=(T &&other)
         {
+#ifndef PLOTMSG_DISABLE
+            PlotMsg::_hold_shared_series(m_shared_series, other);
             PlotMsg::_set_DictItemVal(ref_data[m_key], std::forward<T>(other));
+#endif
             return *this;
         }
 
-        // r-value
-        template <typename T>
-        IndexAccessProxy &operator=(T &&other)
-        {
-            return operator=(other);
-        }
-
         IndexAccessProxy operator[](const std::string &key) const
         {
-            return IndexAccessProxy(*ref_data[m_key].mutable_dict()->mutable_data(), key);
+            return IndexAccessProxy(
+                *ref_data[m_key].mutable_dict()->mutable_data(), key, m_shared_series
+            );
         }
     };
 }  // namespace PlotMsg
\ No newline at end of file
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "core.hpp"
+#include "helpers.hpp"
+
+#include <chrono>
+#include <future>
+
+namespace PlotMsg
+{
+    /**
+     * Hand a finished message over to the background publisher thread, which owns its
+     * encoding and the zmq socket. The thread is started on first use, and the queue it
+     * reads from is bounded (see PublisherOptions::async_queue_size and
+     * PublisherOptions::async_overflow_policy).
+     *
+     * @param msg the message to be published
+     * @param arena the arena that msg lives on (if any), which is released once the message
+     *        has been published (and zmq has sent the frames that point into it)
+     * @param send_flags zmq flags used by the publisher thread to send the message
+     * @param shared_series the shared series that msg refers to, which are held until the
+     *        message has been encoded
+     * @return a future that becomes true once the message was handed to zmq, or false if it
+     *         was dropped (queue overflow, or zmq's high-water mark with dontwait)
+     */
+    std::future<bool> publish_message_async(
+        MessagePtr<MessageContainer> msg, std::shared_ptr<google::protobuf::Arena> arena,
+        zmq::send_flags send_flags, SharedSeriesList shared_series = {}
+    );
+
+    /**
+     * Wait for every message queued (so far) with send_async to be published or dropped.
+     * @return false if the timeout expired first
+     */
+    bool flush(std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+
+    /**
+     * @return the number of figures that were replaced by a newer figure with the same uuid
+     *         before being published (see PublisherOptions::conflate)
+     */
+    size_t conflated_frames();
+
+}  // namespace PlotMsg
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace PlotMsg
+{
+    // A log that is recorded with PublisherOptions::record_path starts with the 8 bytes of
+    // record_log_magic, followed by one record per published message, each of which is (in
+    // little-endian): a RecordHeader, the uuid of the figure (uuid_size bytes, none for
+    // dictionaries), and the size (as uint64) and bytes of each of its zmq frames.
+    constexpr char record_log_magic[8] = {'P', 'M', 'S', 'G', 'L', 'O', 'G', '1'};
+
+    // the fields of a record header, which are written one after the other (encoded_size
+    // bytes without padding), rather than as this struct
+    struct RecordHeader
+    {
+        static constexpr size_t encoded_size = 24;
+
+        // bytes of the record that follow this field
+        uint64_t size;
+        // wall-clock time at which the message was encoded, in ns since the epoch
+        int64_t time_ns;
+        uint32_t uuid_size;
+        uint32_t num_frames;
+    };
+
+    // a record of a log in memory (e.g. a mapped log file), whose frames view that memory
+    struct RecordView
+    {
+        int64_t time_ns;
+        std::string uuid;
+        // data and size of each frame
+        std::vector<std::pair<const char *, size_t>> frames;
+    };
+
+    // the records of the log in the given buffer, without a truncated last record (e.g. of a
+    // publisher that is still recording), throws std::runtime_error if it is not a log
+    std::vector<RecordView> parse_record_log(const char *data, size_t size);
+
+    // wait until every message that was recorded so far is written to the log file
+    void flush_recording();
+
+}  // namespace PlotMsg
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace PlotMsg
+{
+    // histogram with power-of-two buckets: bucket i counts the values in [2^(i-1), 2^i), and
+    // bucket 0 counts the zeros
+    struct Histogram
+    {
+        static constexpr size_t num_buckets = 65;
+
+        std::array<uint64_t, num_buckets> buckets{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        double mean() const
+        {
+            return count == 0 ? 0 : static_cast<double>(sum) / count;
+        }
+
+        // upper bound of the bucket that holds the given percentile (p in [0, 1])
+        uint64_t percentile(double p) const;
+    };
+
+    // counters of the messages that were published (as a whole, or of one figure uuid)
+    struct FrameStats
+    {
+        uint64_t frames_sent = 0;
+        // rejected by zmq (e.g. dontwait at the high-water mark), or by the async queue
+        uint64_t frames_dropped = 0;
+        uint64_t bytes_sent = 0;
+
+        Histogram encode_ns;
+        Histogram send_ns;
+        Histogram payload_bytes;
+    };
+
+    struct PublisherStats
+    {
+        FrameStats total;
+        // by figure uuid
+        std::map<std::string, FrameStats> figures;
+
+        // messages that are queued (or held) by the background publisher, now and at every
+        // send_async
+        size_t queue_depth = 0;
+        Histogram queue_depth_at_push;
+
+        // see conflated_frames and PublisherOptions::skip_without_subscribers
+        uint64_t frames_conflated = 0;
+        uint64_t frames_skipped = 0;
+        // see PlotMsg::num_subscriptions
+        size_t num_subscriptions = 0;
+    };
+
+    // snapshot of the publisher's counters (which are updated without taking locks)
+    PublisherStats stats();
+
+    void reset_stats();
+
+    // call callback with stats() every period from a background thread (the stats are written
+    // to std::cerr without a callback), a zero period stops it
+    void dump_stats_every(
+        std::chrono::milliseconds period,
+        std::function<void(const PublisherStats &)> callback = nullptr
+    );
+
+    std::ostream &operator<<(std::ostream &out, const PublisherStats &stats);
+
+}  // namespace PlotMsg
@@ -13,6 +13,12 @@ namespace PlotMsg
         {
         }
 
+        // trace whose kwargs are allocated on the given arena
+        explicit Trace(google::protobuf::Arena *arena)
+          : m_method(PlotlyTrace::graph_objects), m_kwargs(arena)
+        {
+        }
+
         Trace(PlotlyTrace::CreationMethods method, std::string method_func, Dictionary &kwargs);
 
         Trace(
@@ -41,12 +47,11 @@ namespace PlotMsg
             m_method_func = trace.m_method_func;
         }
 
-        // rvalue-construct
+        // rvalue-construct (takes over the kwargs, together with the arena it lives on)
         Trace(Trace &&trace) noexcept
+          : m_method(trace.m_method), m_method_func(std::move(trace.m_method_func)),
+            m_kwargs(std::move(trace.m_kwargs))
         {
-            m_kwargs.set_kwargs(trace.m_kwargs);
-            m_method = trace.m_method;
-            m_method_func = trace.m_method_func;
         }
 
         // implicit conversion from a single trace to a list of traces (with one item)
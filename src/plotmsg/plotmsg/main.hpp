@@ -5,5 +5,8 @@
 #include "plotmsg/_impl/figure.hpp"
 #include "plotmsg/_impl/helpers.hpp"
 #include "plotmsg/_impl/index_proxy_access.hpp"
+#include "plotmsg/_impl/publisher.hpp"
+#include "plotmsg/_impl/recorder.hpp"
 #include "plotmsg/_impl/series_any.hpp"
+#include "plotmsg/_impl/stats.hpp"
 #include "plotmsg/_impl/trace.hpp"
\ No newline at end of file
@@ -1,18 +1,2292 @@
 
 #include "plotmsg/main.hpp"
+#include "plotmsg/_impl/bounded_queue.hpp"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef WITH_LZ4
+#include <lz4.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <iostream>
+#include <mutex>
+#include <system_error>
+#include <unordered_map>
 
 namespace PlotMsg
 {
+    PublisherOptions static_publisher_options;
+
+    ////////////////////////////////////////
+    // fan-in of multiple producer threads
+    ////////////////////////////////////////
+
+    static std::atomic<size_t> s_num_subscriptions{0};
+    static std::mutex s_subscribers_mutex;
+    // number of subscriptions to each topic
+    static std::map<std::string, size_t> s_subscriptions;
+    static std::condition_variable s_subscribers_cv;
+
+    static constexpr int s_thread_socket_linger_ms = 1000;
+
+    class FanInPublisher
+    {
+        /*
+         * Owns the PUB socket, and forwards every (multipart) message that the producer
+         * threads push into PLOTMSG_FAN_IN_ADDR. The frames are moved along, not copied.
+         * For an XPUB socket, it also counts the subscriptions that are made to it.
+         */
+    public:
+        FanInPublisher(zmq::context_t &context, zmq::socket_t &publisher, bool track_subscribers)
+          : m_pull(context, ZMQ_PULL), m_publisher(publisher),
+            m_track_subscribers(track_subscribers)
+        {
+            m_pull.set(zmq::sockopt::linger, 0);
+            m_pull.bind(PLOTMSG_FAN_IN_ADDR);
+            m_thread = std::thread(&FanInPublisher::run, this);
+        }
+
+        ~FanInPublisher()
+        {
+            m_stop.store(true);
+            m_thread.join();
+        }
+
+        static zmq::socket_t &thread_socket()
+        {
+            // closed when the thread exits (for the main thread, before static_context)
+            thread_local std::unique_ptr<zmq::socket_t> socket;
+            if (socket == nullptr)
+            {
+                socket = std::make_unique<zmq::socket_t>(*static_context, ZMQ_PUSH);
+                // the messages that are still in the pipe when the thread exits are delivered
+                // (bounded, such that the context is not held up by a stopped fan-in thread)
+                socket->set(zmq::sockopt::linger, s_thread_socket_linger_ms);
+                socket->connect(PLOTMSG_FAN_IN_ADDR);
+            }
+            return *socket;
+        }
+
+    private:
+        void run()
+        {
+            zmq::pollitem_t items[] = {
+                {m_pull.handle(), 0, ZMQ_POLLIN, 0},
+                {m_publisher.handle(), 0, ZMQ_POLLIN, 0},
+            };
+            zmq::message_t frame;
+            while (!m_stop.load())
+            {
+                // wake up regularly to check whether we are being stopped
+                zmq::poll(items, m_track_subscribers ? 2 : 1, std::chrono::milliseconds(100));
+                if (items[1].revents & ZMQ_POLLIN)
+                    _receive_subscriptions();
+                if (!(items[0].revents & ZMQ_POLLIN) || !m_pull.recv(frame))
+                    continue;
+                // the parts of a multipart message are always delivered together
+                bool more;
+                do
+                {
+                    more = frame.more();
+                    (void)m_publisher.send(
+                        frame, more ? zmq::send_flags::sndmore : zmq::send_flags::none
+                    );
+                } while (more && m_pull.recv(frame));
+            }
+        }
+
+        void _receive_subscriptions()
+        {
+            zmq::message_t event;
+            while (m_publisher.recv(event, zmq::recv_flags::dontwait))
+            {
+                // the first byte is 1 for a subscription, and 0 for an unsubscription
+                if (event.size() == 0)
+                    continue;
+                std::lock_guard<std::mutex> lock(s_subscribers_mutex);
+                const std::string topic(event.data<char>() + 1, event.size() - 1);
+                if (event.data<uint8_t>()[0] == 1)
+                {
+                    s_num_subscriptions.fetch_add(1);
+                    ++s_subscriptions[topic];
+                }
+                else
+                {
+                    // only the subscriptions that were counted are taken back
+                    auto it = s_subscriptions.find(topic);
+                    if (it == s_subscriptions.end())
+                        continue;
+                    s_num_subscriptions.fetch_sub(1);
+                    if (--it->second == 0)
+                        s_subscriptions.erase(it);
+                }
+                s_subscribers_cv.notify_all();
+            }
+        }
+
+        zmq::socket_t m_pull;
+        zmq::socket_t &m_publisher;
+        const bool m_track_subscribers;
+        std::thread m_thread;
+        std::atomic<bool> m_stop{false};
+    };
+
+    static std::mutex s_initialise_mutex;
+    static std::atomic<bool> s_initialised{false};
+    // non-null once the fan-in thread owns static_publisher
+    static FanInPublisher *s_fan_in = nullptr;
+
+    // the address that static_publisher is bound to (written before s_initialised is set)
+    static std::string s_publisher_addr;
+
+    // brings the publisher up for has_listeners, which must not wait for the subscriptions
+    struct BackgroundInitialiser
+    {
+        std::once_flag started;
+        std::thread thread;
+
+        ~BackgroundInitialiser()
+        {
+            if (thread.joinable())
+                thread.join();
+        }
+    };
+    static BackgroundInitialiser s_background_initialiser;
+
+    // whether the publisher is up, starting it in the background otherwise
+    bool _publisher_is_up()
+    {
+        if (s_initialised.load(std::memory_order_acquire))
+            return true;
+        std::call_once(s_background_initialiser.started, [] {
+            s_background_initialiser.thread = std::thread(_ensure_publisher);
+        });
+        return false;
+    }
+
+    void _start_recording();
+
+    void _initialise_publisher(int sleep_after_bind, const std::string &addr, bool configured)
+    {
+        /*
+         * Bind the publisher to addr, unless it is up already. configured is whether addr was
+         * given by the user (rather than being the default of a message that was sent before
+         * the publisher was initialised), which then has to be the address it is bound to.
+         */
+#ifdef PLOTMSG_DISABLE
+        (void)sleep_after_bind;
+        (void)addr;
+        (void)configured;
+#else
+        auto check_addr = [&addr, configured] {
+            if (configured && addr != s_publisher_addr)
+                throw std::logic_error(
+                    "The plotmsg publisher is already bound to " + s_publisher_addr +
+                    ", hence it cannot be bound to " + addr + " as well."
+                );
+        };
+        if (s_initialised.load(std::memory_order_acquire))
+        {
+            check_addr();
+            return;
+        }
+        std::lock_guard<std::mutex> lock(s_initialise_mutex);
+        if (s_initialised.load() || static_publisher != nullptr)
+        {
+            check_addr();
+            return;
+        }
+        s_publisher_addr = addr;
+        // constructed before the background publisher, hence stopped after it
+        _start_recording();
+        if (static_publisher_options.record_only)
+        {
+            static_context = std::make_unique<zmq::context_t>();
+            s_initialised.store(true, std::memory_order_release);
+            return;
+        }
+        const bool track_subscribers = static_publisher_options.track_subscribers;
+        static_context = std::make_unique<zmq::context_t>();
+        static_publisher = std::make_unique<zmq::socket_t>(
+            *static_context, track_subscribers ? ZMQ_XPUB : ZMQ_PUB
+        );
+        if (track_subscribers)
+        {
+#ifdef ZMQ_XPUB_VERBOSER
+            // pass on every (un)subscription, not only the first one of each topic
+            static_publisher->set(zmq::sockopt::xpub_verboser, 1);
+#else
+            static_publisher->set(zmq::sockopt::xpub_verbose, 1);
+#endif
+        }
+        static_publisher->bind(addr);
+        if (static_publisher_options.multi_producer || track_subscribers)
+        {
+            // constructed after static_context, hence stopped before it is destroyed
+            static FanInPublisher fan_in(*static_context, *static_publisher, track_subscribers);
+            s_fan_in = &fan_in;
+        }
+        if (track_subscribers)
+            wait_for_subscriptions(
+                static_publisher_options.wait_for_subscriptions,
+                static_publisher_options.subscription_wait_timeout
+            );
+        else if (sleep_after_bind > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(sleep_after_bind));
+        s_initialised.store(true, std::memory_order_release);
+#endif
+    }
+
+    void initialise_publisher(int sleep_after_bind, const std::string &addr)
+    {
+        _initialise_publisher(sleep_after_bind, addr, true);
+    }
+
+    void initialise_publisher(int sleep_after_bind, const char *addr)
+    {
+        _initialise_publisher(sleep_after_bind, addr, true);
+    }
+
+    void _ensure_publisher()
+    {
+        if (!s_initialised.load(std::memory_order_acquire))
+            _initialise_publisher(1000, PLOTMSG_DEFAULT_ADDR, false);
+    }
+
+    size_t num_subscriptions()
+    {
+        return s_num_subscriptions.load(std::memory_order_relaxed);
+    }
+
+    std::string message_topic(const MessageContainer &msg)
+    {
+        if (msg.has_fig())
+            return "fig/" + msg.fig().uuid() + '\0';
+        return std::string("dict\0", 5);
+    }
+
+    bool _has_subscription(const std::string &topic)
+    {
+        // zmq matches the subscriptions as prefixes of the topic
+        std::lock_guard<std::mutex> lock(s_subscribers_mutex);
+        for (auto &&kv_pair : s_subscriptions)
+            if (topic.compare(0, kv_pair.first.size(), kv_pair.first) == 0)
+                return true;
+        return false;
+    }
+
+#ifndef PLOTMSG_DISABLE
+    bool has_listeners()
+    {
+        if (!static_publisher_options.track_subscribers)
+            return true;
+        // nobody can be subscribed before the publisher is up
+        return _publisher_is_up() && num_subscriptions() > 0;
+    }
+
+    bool has_listeners(const std::string &uuid)
+    {
+        if (!static_publisher_options.track_subscribers || !static_publisher_options.topic_frames)
+            return has_listeners();
+        return _publisher_is_up() && _has_subscription("fig/" + uuid + '\0');
+    }
+#endif
+
+    bool wait_for_subscriptions(size_t n, std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(s_subscribers_mutex);
+        return s_subscribers_cv.wait_for(lock, timeout, [n] {
+            return s_num_subscriptions.load() >= n;
+        });
+    }
+
+    ////////////////////////////////////////
+    // shared series
+    ////////////////////////////////////////
+
+    struct SharedSeriesRegistry
+    {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, std::weak_ptr<const NDArrayMsg>> arrays;
+        uint64_t next_id = 1;
+    };
+
+    SharedSeriesRegistry &_shared_series_registry()
+    {
+        // never destroyed, as shared series might be held by other static objects
+        static auto *registry = new SharedSeriesRegistry();
+        return *registry;
+    }
+
+    SharedSeries _make_shared_series(NDArrayMsg *array)
+    {
+        auto &registry = _shared_series_registry();
+        std::unique_lock<std::mutex> lock(registry.mutex);
+        const uint64_t id = registry.next_id++;
+        std::shared_ptr<const NDArrayMsg> shared(array, [id](const NDArrayMsg *array) {
+            auto &registry = _shared_series_registry();
+            {
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                registry.arrays.erase(id);
+            }
+            delete array;
+        });
+        registry.arrays.emplace(id, shared);
+        lock.unlock();
+        return {id, std::move(shared)};
+    }
+
+    std::shared_ptr<const NDArrayMsg> _find_shared_series(uint64_t id)
+    {
+        std::shared_ptr<const NDArrayMsg> array;
+        {
+            auto &registry = _shared_series_registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            auto it = registry.arrays.find(id);
+            if (it != registry.arrays.end())
+                array = it->second.lock();
+        }
+        if (!array)
+            throw std::logic_error(
+                "Shared series " + std::to_string(id) + " is no longer held by any message."
+            );
+        return array;
+    }
+
+    ////////////////////////////////////////
+    // encoding and publishing of messages
+    ////////////////////////////////////////
+
+    // call f with every item of the (top-level) dictionaries of the given message, and with
+    // every entry of its series table
+    template <typename F>
+    void _for_each_item(MessageContainer &msg, F &&f)
+    {
+        auto for_each = [&f](DictionaryMsg &dict) {
+            for (auto &&kv_pair : *dict.mutable_data())
+                f(kv_pair.second);
+        };
+        if (msg.has_dict())
+            for_each(*msg.mutable_dict());
+        else if (msg.has_fig())
+        {
+            for (auto &&trace : *msg.mutable_fig()->mutable_traces())
+                for_each(*trace.mutable_kwargs());
+            for (auto &&cmd : *msg.mutable_fig()->mutable_commands())
+                for_each(*cmd.mutable_kwargs());
+            for (auto &&extend : *msg.mutable_fig()->mutable_extends())
+                for_each(*extend.mutable_data());
+        }
+        for (auto &&entry : *msg.mutable_series_table())
+            f(entry);
+    }
+
+    ////////////////////////////////////////
+    // shared-memory ring of large series
+    ////////////////////////////////////////
+
+    class ShmRing
+    {
+        /*
+         * A POSIX shared-memory region that large series are copied into, for subscribers on
+         * the same host. The region starts with a header of (little-endian) uint64 values:
+         * a magic number, the capacity of the ring, and its write position, i.e., the number
+         * of bytes reserved so far. A series that was reserved at position generation is
+         * stored at offset s_header_size + generation % capacity, and is intact while the
+         * write position is at most generation + capacity. The write position is advanced
+         * before the reserved bytes are written, such that readers can tell whether a series
+         * is still intact after they used it.
+         */
+    public:
+        static constexpr size_t s_header_size = 64;
+        static constexpr uint64_t s_magic = 0x314d485347534d50;  // "PMSGSHM1"
+
+        // the ring of this process, created with the options of its first use
+        static ShmRing &instance()
+        {
+            // leaked, as the series might still be encoded during static destruction
+            static ShmRing *ring = new ShmRing(
+                static_publisher_options.shm_name.empty()
+                    ? "/plotmsg-" + std::to_string(getpid())
+                    : static_publisher_options.shm_name,
+                static_publisher_options.shm_size
+            );
+            return *ring;
+        }
+
+        const std::string &name() const
+        {
+            return m_name;
+        }
+
+        // copy size bytes into the ring, returns false if they do not fit the ring
+        bool write(const void *data, size_t size, uint64_t &offset, uint64_t &generation)
+        {
+            if (size > m_capacity)
+                return false;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                uint64_t position = m_write_pos->load(std::memory_order_relaxed);
+                // series are contiguous, hence the tail of the ring is skipped if too short
+                if (position % m_capacity + size > m_capacity)
+                    position += m_capacity - position % m_capacity;
+                generation = position;
+                // keep series aligned to cache lines
+                const uint64_t end = (position + size + 63) & ~uint64_t(63);
+                m_write_pos->store(end, std::memory_order_release);
+            }
+            offset = s_header_size + generation % m_capacity;
+            std::memcpy(m_region + offset, data, size);
+            return true;
+        }
+
+    private:
+        ShmRing(std::string name, size_t capacity)
+          : m_name(std::move(name)),
+            m_capacity((std::max<size_t>(capacity, 64) + 63) & ~size_t(63))
+        {
+            const int fd = shm_open(m_name.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "shm_open " + m_name);
+            const size_t region_size = s_header_size + m_capacity;
+            void *region = MAP_FAILED;
+            if (ftruncate(fd, static_cast<off_t>(region_size)) == 0)
+                region = mmap(nullptr, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            const int error = errno;
+            close(fd);
+            if (region == MAP_FAILED)
+            {
+                shm_unlink(m_name.c_str());
+                throw std::system_error(error, std::generic_category(), "mmap " + m_name);
+            }
+            m_region = static_cast<uint8_t *>(region);
+
+            const uint64_t header[2] = {s_magic, m_capacity};
+            std::memcpy(m_region, header, sizeof(header));
+            m_write_pos = new (m_region + sizeof(header)) std::atomic<uint64_t>(0);
+            // the mapping stays valid for the subscribers that opened it already
+            std::atexit([] { shm_unlink(instance().name().c_str()); });
+        }
+
+        const std::string m_name;
+        const size_t m_capacity;
+        uint8_t *m_region = nullptr;
+        std::atomic<uint64_t> *m_write_pos = nullptr;
+        std::mutex m_mutex;
+    };
+
+    void _move_series_to_shm(DictItemValMsg &itemVal, size_t threshold)
+    {
+        /*
+         * Replace the given series (or the series in the given dictionary, recursively) with
+         * a reference to a copy of its raw data in the shared-memory ring, if it is at least
+         * threshold bytes and fits the ring.
+         */
+        const void *data = nullptr;
+        size_t size = 0;
+        DType dtype = DTYPE_FLOAT64;
+        const NDArrayMsg *array = nullptr;
+        std::shared_ptr<const NDArrayMsg> shared;
+        switch (itemVal.value_case())
+        {
+            case DictItemValMsg::kDict:
+                for (auto &&kv_pair : *itemVal.mutable_dict()->mutable_data())
+                    _move_series_to_shm(kv_pair.second, threshold);
+                return;
+            case DictItemValMsg::kSeriesD:
+                data = itemVal.series_d().data().data();
+                size = itemVal.series_d().data_size() * sizeof(double);
+                break;
+            case DictItemValMsg::kSeriesI:
+                data = itemVal.series_i().data().data();
+                size = itemVal.series_i().data_size() * sizeof(int32_t);
+                dtype = DTYPE_INT32;
+                break;
+            case DictItemValMsg::kNdarray:
+                array = &itemVal.ndarray();
+                break;
+            case DictItemValMsg::kSharedSeries:
+                shared = _find_shared_series(itemVal.shared_series());
+                array = shared.get();
+                break;
+            default:
+                return;
+        }
+        if (array != nullptr)
+        {
+            // the bits of bool arrays are packed, hence those stay in the message
+            if (array->dtype() == DTYPE_BOOL)
+                return;
+            data = array->data().data();
+            size = array->data().size();
+            dtype = array->dtype();
+        }
+
+        uint64_t offset, generation;
+        if (size < threshold || !ShmRing::instance().write(data, size, offset, generation))
+            return;
+        // the shape has to be kept before the series is replaced
+        std::vector<uint64_t> shape;
+        if (array != nullptr)
+            shape.assign(array->shape().begin(), array->shape().end());
+        auto *ref = itemVal.mutable_series_shm();
+        ref->set_dtype(dtype);
+        for (uint64_t dim : shape)
+            ref->add_shape(dim);
+        ref->set_region(ShmRing::instance().name());
+        ref->set_offset(offset);
+        ref->set_size(size);
+        ref->set_generation(generation);
+    }
+
+    template <typename T>
+    void _free_repeated_field(void * /* data */, void *hint)
+    {
+        delete static_cast<google::protobuf::RepeatedField<T> *>(hint);
+    }
+
+    void _release_arena(void * /* data */, void *hint)
+    {
+        delete static_cast<std::shared_ptr<google::protobuf::Arena> *>(hint);
+    }
+
+    template <typename T>
+    zmq::message_t _repeated_field_to_frame(
+        google::protobuf::RepeatedField<T> *data,
+        const std::shared_ptr<google::protobuf::Arena> &arena
+    )
+    {
+        /*
+         * Take over the buffer of the given repeated field. The buffer is handed to zmq
+         * without copying, and is freed by zmq once the frame has been sent. A buffer on the
+         * given arena stays where it is, and the frame holds on to the arena instead.
+         */
+        if (arena != nullptr && data->GetArena() == arena.get())
+            return zmq::message_t(
+                data->mutable_data(), data->size() * sizeof(T), _release_arena,
+                new std::shared_ptr<google::protobuf::Arena>(arena)
+            );
+        // (a buffer on an arena that is not shared with us has to be copied by Swap)
+        auto *owned = new google::protobuf::RepeatedField<T>();
+        owned->Swap(data);
+        return zmq::message_t(
+            owned->mutable_data(), owned->size() * sizeof(T), _free_repeated_field<T>, owned
+        );
+    }
+
+    void _release_shared_series(void * /* data */, void *hint)
+    {
+        delete static_cast<std::shared_ptr<const NDArrayMsg> *>(hint);
+    }
+
+    void _free_string(void * /* data */, void *hint)
+    {
+        delete static_cast<std::string *>(hint);
+    }
+
+    void _refer_to_frame(
+        DictItemValMsg &itemVal, DType dtype, const std::vector<uint64_t> &shape,
+        std::vector<zmq::message_t> &frames, zmq::message_t frame
+    )
+    {
+        // replace the series with a reference to the given frame (whose index excludes the
+        // protobuf payload frame)
+        auto *ref = itemVal.mutable_series_frame();
+        ref->set_dtype(dtype);
+        ref->set_frame(frames.size() - 1);
+        for (uint64_t dim : shape)
+            ref->add_shape(dim);
+        frames.push_back(std::move(frame));
+    }
+
+    void _move_series_to_frames(
+        DictionaryMsgData &dict, std::vector<zmq::message_t> &frames, size_t threshold,
+        const std::shared_ptr<google::protobuf::Arena> &arena
+    );
+
+    void _move_series_to_frames(
+        DictItemValMsg &itemVal, std::vector<zmq::message_t> &frames, size_t threshold,
+        const std::shared_ptr<google::protobuf::Arena> &arena
+    )
+    {
+        /*
+         * Replace the given series (or the series in the given dictionary, recursively) with
+         * a reference to a new frame that carries its raw data, if it is at least threshold
+         * bytes. arena is the (shared) arena that the message lives on, if any.
+         */
+        switch (itemVal.value_case())
+        {
+            case DictItemValMsg::kDict:
+                _move_series_to_frames(
+                    *itemVal.mutable_dict()->mutable_data(), frames, threshold, arena
+                );
+                break;
+            case DictItemValMsg::kSeriesD:
+                if (itemVal.series_d().data_size() * sizeof(double) >= threshold)
+                {
+                    auto frame =
+                        _repeated_field_to_frame(itemVal.mutable_series_d()->mutable_data(), arena);
+                    _refer_to_frame(itemVal, DTYPE_FLOAT64, {}, frames, std::move(frame));
+                }
+                break;
+            case DictItemValMsg::kSeriesI:
+                if (itemVal.series_i().data_size() * sizeof(int32_t) >= threshold)
+                {
+                    auto frame =
+                        _repeated_field_to_frame(itemVal.mutable_series_i()->mutable_data(), arena);
+                    _refer_to_frame(itemVal, DTYPE_INT32, {}, frames, std::move(frame));
+                }
+                break;
+            case DictItemValMsg::kNdarray:
+            {
+                // the bits of bool arrays are packed, hence those stay in the message
+                auto *array = itemVal.mutable_ndarray();
+                if (array->dtype() == DTYPE_BOOL || array->data().size() < threshold)
+                    break;
+                const DType dtype = array->dtype();
+                const std::vector<uint64_t> shape(array->shape().begin(), array->shape().end());
+                // the message lets go of its bytes (a string on an arena is moved out of it)
+                std::string *bytes = array->release_data();
+                zmq::message_t frame(&(*bytes)[0], bytes->size(), _free_string, bytes);
+                _refer_to_frame(itemVal, dtype, shape, frames, std::move(frame));
+                break;
+            }
+            case DictItemValMsg::kSharedSeries:
+            {
+                // shared series are handed to zmq as they are, and held until zmq has sent them
+                auto array = _find_shared_series(itemVal.shared_series());
+                if (array->dtype() == DTYPE_BOOL || array->data().size() < threshold)
+                    break;
+                const DType dtype = array->dtype();
+                const std::vector<uint64_t> shape(array->shape().begin(), array->shape().end());
+                const auto &bytes = array->data();
+                zmq::message_t frame(
+                    const_cast<char *>(bytes.data()), bytes.size(), _release_shared_series,
+                    new std::shared_ptr<const NDArrayMsg>(std::move(array))
+                );
+                _refer_to_frame(itemVal, dtype, shape, frames, std::move(frame));
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    void _move_series_to_frames(
+        DictionaryMsgData &dict, std::vector<zmq::message_t> &frames, size_t threshold,
+        const std::shared_ptr<google::protobuf::Arena> &arena
+    )
+    {
+        for (auto &&kv_pair : dict)
+            _move_series_to_frames(kv_pair.second, frames, threshold, arena);
+    }
+
+    void _shared_series_to_frames(DictItemValMsg &itemVal, std::vector<zmq::message_t> &frames)
+    {
+        /*
+         * Replace the remaining shared series in the given value (recursively) with frames of
+         * their own, which are handed to zmq straight out of the shared arrays. The arrays are
+         * never spliced into a message, hence messages that share them are encoded
+         * independently of each other.
+         */
+        if (itemVal.value_case() == DictItemValMsg::kDict)
+        {
+            for (auto &&kv_pair : *itemVal.mutable_dict()->mutable_data())
+                _shared_series_to_frames(kv_pair.second, frames);
+        }
+        else if (itemVal.value_case() == DictItemValMsg::kSharedSeries)
+        {
+            // the bits of bool arrays are packed, hence those are copied into the payload
+            auto array = _find_shared_series(itemVal.shared_series());
+            if (array->dtype() == DTYPE_BOOL)
+                itemVal.mutable_ndarray()->CopyFrom(*array);
+            else
+                _move_series_to_frames(itemVal, frames, 0, nullptr);
+        }
+    }
+
+    ////////////////////////////////////////
+    // deduplication of series
+    ////////////////////////////////////////
+
+    // the raw bytes of a series that is compared by content (empty for other values)
+    std::pair<const void *, size_t> _series_bytes(const DictItemValMsg &itemVal)
+    {
+        switch (itemVal.value_case())
+        {
+            case DictItemValMsg::kSeriesD:
+                return {itemVal.series_d().data().data(),
+                        itemVal.series_d().data_size() * sizeof(double)};
+            case DictItemValMsg::kSeriesI:
+                return {itemVal.series_i().data().data(),
+                        itemVal.series_i().data_size() * sizeof(int32_t)};
+            case DictItemValMsg::kNdarray:
+                return {itemVal.ndarray().data().data(), itemVal.ndarray().data().size()};
+            default:
+                return {nullptr, 0};
+        }
+    }
+
+    size_t _hash_bytes(const void *data, size_t size)
+    {
+        // word at a time, as series are typically megabytes
+        const auto *bytes = static_cast<const uint8_t *>(data);
+        uint64_t hash = 0xcbf29ce484222325ull ^ size;
+        uint64_t word;
+        size_t i = 0;
+        for (; i + sizeof(word) <= size; i += sizeof(word))
+        {
+            std::memcpy(&word, bytes + i, sizeof(word));
+            hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+            hash ^= hash >> 29;
+        }
+        for (; i < size; ++i)
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        return static_cast<size_t>(hash);
+    }
+
+    bool _same_series(const DictItemValMsg &a, const DictItemValMsg &b)
+    {
+        if (a.value_case() != b.value_case())
+            return false;
+        if (a.value_case() == DictItemValMsg::kSharedSeries)
+            return a.shared_series() == b.shared_series();
+        if (a.value_case() == DictItemValMsg::kNdarray &&
+            (a.ndarray().dtype() != b.ndarray().dtype() ||
+             !std::equal(
+                 a.ndarray().shape().begin(), a.ndarray().shape().end(),
+                 b.ndarray().shape().begin(), b.ndarray().shape().end()
+             )))
+            return false;
+        const auto bytes_a = _series_bytes(a);
+        const auto bytes_b = _series_bytes(b);
+        return bytes_a.second == bytes_b.second &&
+               std::memcmp(bytes_a.first, bytes_b.first, bytes_a.second) == 0;
+    }
+
+    void _deduplicate_series(MessageContainer &msg, size_t min_bytes)
+    {
+        /*
+         * Move every series that occurs more than once in msg into the series table of msg,
+         * and replace each of its occurrences by a reference to it.
+         */
+        // the occurrences of each distinct series, in order of appearance
+        std::vector<std::vector<DictItemValMsg *>> groups;
+        std::unordered_map<size_t, std::vector<size_t>> by_hash;
+
+        std::function<void(DictItemValMsg &)> collect = [&](DictItemValMsg &itemVal) {
+            size_t hash;
+            if (itemVal.value_case() == DictItemValMsg::kDict)
+            {
+                for (auto &&kv_pair : *itemVal.mutable_dict()->mutable_data())
+                    collect(kv_pair.second);
+                return;
+            }
+            else if (itemVal.value_case() == DictItemValMsg::kSharedSeries)
+                hash = std::hash<uint64_t>()(itemVal.shared_series());
+            else
+            {
+                const auto bytes = _series_bytes(itemVal);
+                if (bytes.first == nullptr || bytes.second < min_bytes)
+                    return;
+                hash = _hash_bytes(bytes.first, bytes.second);
+            }
+
+            auto &candidates = by_hash[hash];
+            for (size_t group : candidates)
+            {
+                if (_same_series(*groups[group].front(), itemVal))
+                {
+                    groups[group].push_back(&itemVal);
+                    return;
+                }
+            }
+            candidates.push_back(groups.size());
+            groups.push_back({&itemVal});
+        };
+        _for_each_item(msg, collect);
+
+        for (auto &&group : groups)
+        {
+            if (group.size() < 2)
+                continue;
+            const uint32_t index = msg.series_table_size();
+            msg.add_series_table()->Swap(group.front());
+            for (auto *itemVal : group)
+                itemVal->set_series_ref(index);
+        }
+    }
+
+    ////////////////////////////////////////
+    // delta updates of figures
+    ////////////////////////////////////////
+
+    // the value of a key as it was sent: a hash to tell most changes apart quickly, and the
+    // bytes that decide whether the value is unchanged when the hashes match
+    struct Fingerprint
+    {
+        size_t hash;
+        // the serialised value, or the raw bytes of a series behind its type and shape
+        std::string bytes;
+
+        bool operator==(const Fingerprint &other) const
+        {
+            return hash == other.hash && bytes == other.bytes;
+        }
+    };
+
+    // what was last sent for each trace of a figure
+    struct SentTrace
+    {
+        PlotlyTrace::CreationMethods method;
+        std::string method_func;
+        std::unordered_map<std::string, Fingerprint> fingerprints;
+    };
+
+    struct SentFigure
+    {
+        std::vector<SentTrace> traces;
+        size_t frames_since_keyframe = 0;
+    };
+
+    static std::mutex s_sent_figures_mutex;
+    static std::unordered_map<std::string, SentFigure> s_sent_figures;
+
+    Fingerprint _fingerprint(const DictItemValMsg &value)
+    {
+        // series are copied as they are, as serialising them would cost about as much as
+        // sending them
+        Fingerprint fingerprint;
+        const auto bytes = _series_bytes(value);
+        if (bytes.first != nullptr)
+        {
+            std::vector<uint64_t> header{static_cast<uint64_t>(value.value_case())};
+            if (value.has_ndarray())
+            {
+                header.push_back(value.ndarray().dtype());
+                header.insert(
+                    header.end(), value.ndarray().shape().begin(), value.ndarray().shape().end()
+                );
+            }
+            const size_t header_size = header.size() * sizeof(uint64_t);
+            fingerprint.bytes.resize(header_size + bytes.second);
+            std::memcpy(&fingerprint.bytes[0], header.data(), header_size);
+            std::memcpy(&fingerprint.bytes[header_size], bytes.first, bytes.second);
+        }
+        else
+        {
+            value.ByteSizeLong();  // caches the sizes of nested messages
+            // maps have to be serialised in the same order for equal values to match
+            google::protobuf::io::StringOutputStream stream(&fingerprint.bytes);
+            google::protobuf::io::CodedOutputStream output(&stream);
+            output.SetSerializationDeterministic(true);
+            value.SerializeWithCachedSizes(&output);
+        }
+        fingerprint.hash = _hash_bytes(fingerprint.bytes.data(), fingerprint.bytes.size());
+        return fingerprint;
+    }
+
+    void _reduce_to_patch(PlotlyFigureMsg &fig)
+    {
+        /*
+         * Remove every key of the figure's traces whose value is the same as in the last
+         * frame that was sent with the same uuid, and mark the figure as a patch. The figure
+         * is left whole if it cannot be applied as a patch.
+         */
+        std::vector<SentTrace> traces(fig.traces_size());
+        for (int i = 0; i < fig.traces_size(); ++i)
+        {
+            const auto &trace = fig.traces(i);
+            traces[i].method = trace.method();
+            traces[i].method_func = trace.method_func();
+            for (auto &&kv_pair : trace.kwargs().data())
+                traces[i].fingerprints.emplace(kv_pair.first, _fingerprint(kv_pair.second));
+        }
+
+        std::lock_guard<std::mutex> lock(s_sent_figures_mutex);
+        auto &sent = s_sent_figures[fig.uuid()];
+
+        bool keyframe = sent.traces.size() != traces.size() ||
+                        ++sent.frames_since_keyframe >=
+                            static_publisher_options.delta_keyframe_interval;
+        for (size_t i = 0; i < traces.size() && !keyframe; ++i)
+        {
+            keyframe = sent.traces[i].method != traces[i].method ||
+                       sent.traces[i].method_func != traces[i].method_func;
+            // a removed key cannot be expressed as a patch
+            for (auto &&kv_pair : sent.traces[i].fingerprints)
+                keyframe = keyframe || traces[i].fingerprints.count(kv_pair.first) == 0;
+        }
+
+        if (keyframe)
+            sent.frames_since_keyframe = 0;
+        else
+        {
+            for (size_t i = 0; i < traces.size(); ++i)
+            {
+                auto &kwargs = *fig.mutable_traces(i)->mutable_kwargs()->mutable_data();
+                const auto &sent_fingerprints = sent.traces[i].fingerprints;
+                for (auto it = kwargs.begin(); it != kwargs.end();)
+                {
+                    auto sent_it = sent_fingerprints.find(it->first);
+                    if (sent_it != sent_fingerprints.end() &&
+                        sent_it->second == traces[i].fingerprints[it->first])
+                        it = kwargs.erase(it);
+                    else
+                        ++it;
+                }
+            }
+            fig.set_patch(true);
+        }
+        sent.traces = std::move(traces);
+    }
+
+    ////////////////////////////////////////
+    // workers for serialising and compressing payloads
+    ////////////////////////////////////////
+
+    class WorkerPool
+    {
+        /*
+         * Threads that are shared by the parallel serialisation and compression of payloads.
+         * They are started by the first parallel job (and added as more are needed), and
+         * joined at exit. Jobs of concurrent publishers are queued behind each other.
+         */
+    public:
+        // leaked, as payloads might still be encoded during static destruction (after the
+        // workers were joined, such jobs run on the calling thread)
+        static WorkerPool &instance()
+        {
+            static WorkerPool *pool = [] {
+                auto *pool = new WorkerPool();
+                std::atexit([] { instance().stop(); });
+                return pool;
+            }();
+            return *pool;
+        }
+
+        // runs job(0), ..., job(num_jobs - 1), the first on the calling thread and the others
+        // on the workers, and returns once all of them are done
+        void run(size_t num_jobs, const std::function<void(size_t)> &job)
+        {
+            Batch batch{&job, num_jobs - 1, {}};
+            bool stopped;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                stopped = m_stopped;
+                if (!stopped)
+                {
+                    while (m_workers.size() < num_jobs - 1)
+                        m_workers.emplace_back(&WorkerPool::work, this);
+                    for (size_t i = 1; i < num_jobs; ++i)
+                        m_tasks.emplace_back(&batch, i);
+                }
+            }
+            if (stopped)
+            {
+                for (size_t i = 0; i < num_jobs; ++i)
+                    job(i);
+                return;
+            }
+            m_cv.notify_all();
+            job(0);
+            std::unique_lock<std::mutex> lock(m_mutex);
+            batch.done.wait(lock, [&batch] { return batch.remaining == 0; });
+        }
+
+    private:
+        struct Batch
+        {
+            const std::function<void(size_t)> *job;
+            // guarded by m_mutex
+            size_t remaining;
+            std::condition_variable done;
+        };
+
+        void work()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while (true)
+            {
+                m_cv.wait(lock, [this] { return m_stopped || !m_tasks.empty(); });
+                // the queued jobs are finished before the workers stop
+                if (m_tasks.empty())
+                    return;
+                const auto task = m_tasks.front();
+                m_tasks.pop_front();
+                lock.unlock();
+                (*task.first->job)(task.second);
+                lock.lock();
+                // notified under the lock, as the batch lives on the stack of its caller
+                if (--task.first->remaining == 0)
+                    task.first->done.notify_all();
+            }
+        }
+
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopped = true;
+            }
+            m_cv.notify_all();
+            for (auto &&worker : m_workers)
+                worker.join();
+        }
+
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<std::pair<Batch *, size_t>> m_tasks;
+        std::vector<std::thread> m_workers;
+        bool m_stopped = false;
+    };
+
+    ////////////////////////////////////////
+    // compression of payloads
+    ////////////////////////////////////////
+    // A compressed payload frame starts with a header of (little-endian)
+    //   uint8 0, uint8 codec, uint16 0, uint32 num_chunks, uint64 raw_size, uint32 chunk_size
+    // followed by the compressed size (uint32) of each chunk, and the compressed chunks. The
+    // leading zero is not a valid protobuf tag, which tells it apart from a raw payload.
+    static constexpr size_t s_compressed_header_size = 20;
+
+    size_t _compress_bound(Codec codec, size_t size)
+    {
+        switch (codec)
+        {
+#ifdef WITH_ZSTD
+            case Codec::zstd:
+                return ZSTD_compressBound(size);
+#endif
+#ifdef WITH_LZ4
+            case Codec::lz4:
+                return LZ4_compressBound(static_cast<int>(size));
+#endif
+            default:
+                throw std::invalid_argument(
+                    "plotmsg was built without support for the requested compression codec."
+                );
+        }
+    }
+
+    size_t _compress_chunk(
+        Codec codec, int level, const char *src, size_t size, char *dst, size_t capacity
+    )
+    {
+        // returns the compressed size, or zero if the chunk could not be compressed
+        switch (codec)
+        {
+#ifdef WITH_ZSTD
+            case Codec::zstd:
+            {
+                size_t compressed = ZSTD_compress(dst, capacity, src, size, level);
+                return ZSTD_isError(compressed) ? 0 : compressed;
+            }
+#endif
+#ifdef WITH_LZ4
+            case Codec::lz4:
+                return LZ4_compress_fast(
+                    src, dst, static_cast<int>(size), static_cast<int>(capacity),
+                    std::max(level, 1)
+                );
+#endif
+            default:
+                return 0;
+        }
+    }
+
+    void _free_compressed_buffer(void *data, void * /* hint */)
+    {
+        delete[] static_cast<char *>(data);
+    }
+
+    bool _compress_payload(zmq::message_t &frame)
+    {
+        /*
+         * Replace the given payload frame with its compressed frame. Returns false (and
+         * leaves the frame as it is) if compressing it does not make it smaller.
+         */
+        const Codec codec = static_publisher_options.compression_codec;
+        const int level = static_publisher_options.compression_level;
+        const char *src = frame.data<char>();
+        const size_t raw_size = frame.size();
+        // the compressed size of each chunk has to fit the header
+        const size_t chunk_size = std::min<size_t>(
+            std::max<size_t>(static_publisher_options.compression_chunk_size, 1), 1u << 30
+        );
+        const size_t num_chunks = (raw_size + chunk_size - 1) / chunk_size;
+        const size_t header_size = s_compressed_header_size + num_chunks * sizeof(uint32_t);
+
+        // each chunk is compressed into its own slot of the buffer, and packed afterwards
+        const size_t slot_size = _compress_bound(codec, chunk_size);
+        std::unique_ptr<char[]> buffer(new char[header_size + num_chunks * slot_size]);
+        std::vector<uint32_t> sizes(num_chunks);
+
+        size_t num_threads = static_publisher_options.compression_threads;
+        if (num_threads == 0)
+            num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        num_threads = std::min(num_threads, num_chunks);
+        auto compress = [&](size_t first) {
+            for (size_t i = first; i < num_chunks; i += num_threads)
+            {
+                const size_t offset = i * chunk_size;
+                sizes[i] = static_cast<uint32_t>(_compress_chunk(
+                    codec, level, src + offset, std::min(chunk_size, raw_size - offset),
+                    buffer.get() + header_size + i * slot_size, slot_size
+                ));
+            }
+        };
+        WorkerPool::instance().run(num_threads, compress);
+
+        char *out = buffer.get() + header_size;
+        for (size_t i = 0; i < num_chunks; ++i)
+        {
+            if (sizes[i] == 0)
+                return false;
+            std::memmove(out, buffer.get() + header_size + i * slot_size, sizes[i]);
+            out += sizes[i];
+        }
+        const size_t compressed_size = out - buffer.get();
+        if (compressed_size >= raw_size)
+            return false;
+
+        const uint8_t header_codec = static_cast<uint8_t>(codec);
+        const uint32_t header_num_chunks = static_cast<uint32_t>(num_chunks);
+        const uint64_t header_raw_size = raw_size;
+        const uint32_t header_chunk_size = static_cast<uint32_t>(chunk_size);
+        std::memset(buffer.get(), 0, s_compressed_header_size);
+        std::memcpy(buffer.get() + 1, &header_codec, 1);
+        std::memcpy(buffer.get() + 4, &header_num_chunks, 4);
+        std::memcpy(buffer.get() + 8, &header_raw_size, 8);
+        std::memcpy(buffer.get() + 16, &header_chunk_size, 4);
+        std::memcpy(buffer.get() + s_compressed_header_size, sizes.data(), num_chunks * 4);
+
+        frame = zmq::message_t(buffer.release(), compressed_size, _free_compressed_buffer, nullptr);
+        return true;
+    }
+
+    void _serialize_payload(MessageContainer &msg, zmq::message_t &frame)
+    {
+        /*
+         * Serialise msg straight into the zmq-owned buffer of frame. The traces of a large
+         * figure are serialised in parallel: the payload then holds the message without its
+         * traces, followed by one more fig record ({traces: [trace]}) per trace. The parser
+         * merges repeated records of a message field (appending the repeated traces in
+         * order), hence the payload decodes to the same message.
+         */
+        using google::protobuf::io::CodedOutputStream;
+        const size_t size = msg.ByteSizeLong();
+        const int num_traces = msg.has_fig() ? msg.fig().traces_size() : 0;
+        size_t num_threads = static_publisher_options.parallel_encode_threads;
+        if (num_threads == 0)
+            num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+        num_threads = std::min<size_t>(num_threads, num_traces);
+        if (num_threads < 2 || size < static_publisher_options.parallel_encode_threshold)
+        {
+            frame.rebuild(size);
+            msg.SerializeWithCachedSizesToArray(frame.data<uint8_t>());
+            return;
+        }
+
+        // move the traces aside (on the same arena, hence without copying), their sizes
+        // were cached by ByteSizeLong above
+        PlotlyFigureMsg &fig = *msg.mutable_fig();
+        MessagePtr<PlotlyFigureMsg> traces(
+            google::protobuf::Arena::CreateMessage<PlotlyFigureMsg>(fig.GetArena())
+        );
+        traces->mutable_traces()->Swap(fig.mutable_traces());
+
+        const uint32_t fig_tag = MessageContainer::kFigFieldNumber << 3 | 2;
+        const uint32_t trace_tag = PlotlyFigureMsg::kTracesFieldNumber << 3 | 2;
+        // the offset of the record of each trace in the payload
+        std::vector<size_t> offsets(num_traces + 1);
+        offsets[0] = msg.ByteSizeLong();
+        for (int i = 0; i < num_traces; ++i)
+        {
+            const uint32_t trace_size = traces->traces(i).GetCachedSize();
+            const uint32_t record_size = CodedOutputStream::VarintSize32(trace_tag) +
+                                         CodedOutputStream::VarintSize32(trace_size) + trace_size;
+            offsets[i + 1] = offsets[i] + CodedOutputStream::VarintSize32(fig_tag) +
+                             CodedOutputStream::VarintSize32(record_size) + record_size;
+        }
+
+        frame.rebuild(offsets[num_traces]);
+        uint8_t *out = frame.data<uint8_t>();
+        auto serialize = [&](size_t first) {
+            for (size_t i = first; i < static_cast<size_t>(num_traces); i += num_threads)
+            {
+                const PlotlyTrace &trace = traces->traces(i);
+                const uint32_t trace_size = trace.GetCachedSize();
+                const uint32_t record_size = CodedOutputStream::VarintSize32(trace_tag) +
+                                             CodedOutputStream::VarintSize32(trace_size) +
+                                             trace_size;
+                uint8_t *ptr = out + offsets[i];
+                ptr = CodedOutputStream::WriteVarint32ToArray(fig_tag, ptr);
+                ptr = CodedOutputStream::WriteVarint32ToArray(record_size, ptr);
+                ptr = CodedOutputStream::WriteVarint32ToArray(trace_tag, ptr);
+                ptr = CodedOutputStream::WriteVarint32ToArray(trace_size, ptr);
+                trace.SerializeWithCachedSizesToArray(ptr);
+            }
+        };
+        WorkerPool::instance().run(num_threads, [&](size_t first) {
+            // the message without its traces is written by the calling thread
+            if (first == 0)
+                msg.SerializeWithCachedSizesToArray(out);
+            serialize(first);
+        });
+
+        traces->mutable_traces()->Swap(fig.mutable_traces());
+    }
+
+    // arena is the arena that msg lives on, if its ownership is shared with the caller (the
+    // frames then hold on to it rather than copying series out of it)
+    void _encode_message(
+        MessageContainer &msg, std::vector<zmq::message_t> &frames,
+        const std::shared_ptr<google::protobuf::Arena> &arena
+    )
+    {
+        // the first frame is always the protobuf payload (until the topic frame is put in
+        // front of it)
+        frames.clear();
+        frames.resize(1);
+
+        if (static_publisher_options.delta_updates && msg.has_fig())
+        {
+            if (msg.fig().extends_size() == 0)
+                _reduce_to_patch(*msg.mutable_fig());
+            else
+            {
+                // the extended series no longer match what was last sent, so the next frame
+                // of this uuid has to be whole
+                std::lock_guard<std::mutex> lock(s_sent_figures_mutex);
+                s_sent_figures.erase(msg.fig().uuid());
+            }
+        }
+
+        if (static_publisher_options.dedup_series)
+            _deduplicate_series(msg, static_publisher_options.dedup_min_bytes);
+
+        const size_t shm_threshold = static_publisher_options.shm_threshold;
+        if (shm_threshold > 0)
+            _for_each_item(msg, [shm_threshold](DictItemValMsg &itemVal) {
+                _move_series_to_shm(itemVal, shm_threshold);
+            });
+
+        const size_t threshold = static_publisher_options.multipart_threshold;
+        if (threshold > 0)
+            _for_each_item(msg, [&frames, threshold, &arena](DictItemValMsg &itemVal) {
+                _move_series_to_frames(itemVal, frames, threshold, arena);
+            });
+
+        _for_each_item(msg, [&frames](DictItemValMsg &itemVal) {
+            _shared_series_to_frames(itemVal, frames);
+        });
+
+        _serialize_payload(msg, frames[0]);
+
+        if (static_publisher_options.compression_codec != Codec::none &&
+            frames[0].size() >= static_publisher_options.compression_threshold)
+            _compress_payload(frames[0]);
+
+        if (static_publisher_options.topic_frames)
+        {
+            const std::string topic = message_topic(msg);
+            frames.insert(frames.begin(), zmq::message_t(topic.data(), topic.size()));
+        }
+    }
+
+    std::vector<zmq::message_t> encode_message(MessageContainer &msg)
+    {
+        std::vector<zmq::message_t> frames;
+        _encode_message(msg, frames, nullptr);
+        return frames;
+    }
+
+    bool publish_frames(std::vector<zmq::message_t> &frames, zmq::send_flags send_flags)
+    {
+        zmq::socket_t &socket =
+            s_fan_in != nullptr ? FanInPublisher::thread_socket() : *static_publisher;
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            auto flags = send_flags;
+            if (i + 1 < frames.size())
+                flags = flags | zmq::send_flags::sndmore;
+            // a multipart message is queued atomically, hence stop if the first part is
+            // rejected (e.g. dontwait at the high-water mark)
+            if (!socket.send(frames[i], flags))
+                return false;
+        }
+        return true;
+    }
+
+    ////////////////////////////////////////
+    // recording of published messages
+    ////////////////////////////////////////
+
+    // fixed-size integers of the recording, in little-endian regardless of the host
+    template <typename T>
+    char *_store_le(char *out, T value)
+    {
+        for (size_t i = 0; i < sizeof(T); ++i)
+            out[i] = static_cast<char>(static_cast<uint64_t>(value) >> (8 * i));
+        return out + sizeof(T);
+    }
+
+    template <typename T>
+    T _load_le(const char *in)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < sizeof(T); ++i)
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+        return static_cast<T>(value);
+    }
+
+    class Recorder
+    {
+        /*
+         * Appends the frames of every published message to the log file at
+         * PublisherOptions::record_path (see RecordHeader for the format), from a background
+         * thread. The frames are shared with zmq rather than copied (see zmq_msg_copy).
+         */
+    public:
+        static Recorder &instance()
+        {
+            static Recorder recorder;
+            return recorder;
+        }
+
+        static bool started()
+        {
+            return s_started.load(std::memory_order_acquire);
+        }
+
+        void push(const MessageContainer &msg, std::vector<zmq::message_t> &frames)
+        {
+            Record record;
+            const auto now = std::chrono::system_clock::now().time_since_epoch();
+            record.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+            if (msg.has_fig())
+                record.uuid = msg.fig().uuid();
+            record.frames.resize(frames.size());
+            for (size_t i = 0; i < frames.size(); ++i)
+                record.frames[i].copy(frames[i]);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            // records are never dropped, hence wait for the writer thread to catch up
+            m_space_cv.wait(lock, [this] { return m_queue.size() < m_capacity; });
+            m_queue.push_back(std::move(record));
+            ++m_pushed;
+            m_wake_cv.notify_one();
+        }
+
+        void flush()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            const size_t target = m_pushed;
+            m_done_cv.wait(lock, [this, target] { return m_written >= target; });
+        }
+
+    private:
+        struct Record
+        {
+            int64_t time_ns;
+            std::string uuid;
+            std::vector<zmq::message_t> frames;
+        };
+
+        Recorder()
+          : m_path(static_publisher_options.record_path),
+            m_capacity(std::max<size_t>(static_publisher_options.record_queue_size, 1))
+        {
+            // an existing recording is appended to, rather than overwritten
+            m_file = std::fopen(m_path.c_str(), "a+b");
+            if (m_file == nullptr)
+                throw std::system_error(errno, std::generic_category(), "fopen " + m_path);
+            try
+            {
+                _open_log();
+            }
+            catch (...)
+            {
+                std::fclose(m_file);
+                throw;
+            }
+            std::setvbuf(m_file, nullptr, _IOFBF, 1 << 20);
+            m_thread = std::thread(&Recorder::run, this);
+            s_started.store(true, std::memory_order_release);
+        }
+
+        ~Recorder()
+        {
+            // write whatever is still queued before stopping
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_wake_cv.notify_one();
+            m_thread.join();
+            std::fclose(m_file);
+            s_started.store(false, std::memory_order_release);
+        }
+
+        void _open_log()
+        {
+            /*
+             * Write the magic to an empty file. A file that is not empty has to be a
+             * recording, which is cut behind its last complete record (of a process that
+             * crashed while writing it), such that the new records can be parsed.
+             */
+            std::fseek(m_file, 0, SEEK_END);
+            const uint64_t file_size = static_cast<uint64_t>(ftello(m_file));
+            if (file_size == 0)
+            {
+                std::fwrite(record_log_magic, 1, sizeof(record_log_magic), m_file);
+                return;
+            }
+            char magic[sizeof(record_log_magic)];
+            std::fseek(m_file, 0, SEEK_SET);
+            if (std::fread(magic, sizeof(magic), 1, m_file) != 1 ||
+                std::memcmp(magic, record_log_magic, sizeof(magic)) != 0)
+                throw std::runtime_error(m_path + " exists, and is not a plotmsg recording.");
+            uint64_t end = sizeof(record_log_magic);
+            char size[sizeof(uint64_t)];
+            while (fseeko(m_file, static_cast<off_t>(end), SEEK_SET) == 0 &&
+                   std::fread(size, sizeof(size), 1, m_file) == 1)
+            {
+                const uint64_t record_size = _load_le<uint64_t>(size);
+                if (record_size > file_size - end - sizeof(size))
+                    break;
+                end += sizeof(size) + record_size;
+            }
+            if (end < file_size && ftruncate(fileno(m_file), static_cast<off_t>(end)) != 0)
+                throw std::system_error(errno, std::generic_category(), "ftruncate " + m_path);
+            // (writes go to the end of the file regardless, but reading has to be ended)
+            std::fseek(m_file, 0, SEEK_END);
+        }
+
+        void run()
+        {
+            std::deque<Record> batch;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wake_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                    if (m_queue.empty())
+                        break;
+                    batch.swap(m_queue);
+                }
+                m_space_cv.notify_all();
+
+                bool ok = true;
+                for (auto &&record : batch)
+                    ok &= _write(record);
+                // hand the records to the kernel, such that they survive a crash of the process
+                ok &= std::fflush(m_file) == 0;
+                if (!ok && !m_failed)
+                {
+                    m_failed = true;
+                    std::cerr << "plotmsg: failed to write the recording to " << m_path
+                              << std::endl;
+                }
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_written += batch.size();
+                batch.clear();
+                m_done_cv.notify_all();
+            }
+        }
+
+        bool _write(const Record &record)
+        {
+            uint64_t size = RecordHeader::encoded_size - sizeof(uint64_t) + record.uuid.size();
+            for (auto &&frame : record.frames)
+                size += sizeof(uint64_t) + frame.size();
+
+            char header[RecordHeader::encoded_size];
+            char *out = _store_le(header, size);
+            out = _store_le(out, record.time_ns);
+            out = _store_le(out, static_cast<uint32_t>(record.uuid.size()));
+            _store_le(out, static_cast<uint32_t>(record.frames.size()));
+
+            bool ok = std::fwrite(header, sizeof(header), 1, m_file) == 1;
+            ok &= std::fwrite(record.uuid.data(), 1, record.uuid.size(), m_file) ==
+                  record.uuid.size();
+            for (auto &&frame : record.frames)
+            {
+                char frame_size[sizeof(uint64_t)];
+                _store_le(frame_size, static_cast<uint64_t>(frame.size()));
+                ok &= std::fwrite(frame_size, sizeof(frame_size), 1, m_file) == 1;
+                ok &= std::fwrite(frame.data(), 1, frame.size(), m_file) == frame.size();
+            }
+            return ok;
+        }
+
+        static std::atomic<bool> s_started;
+
+        const std::string m_path;
+        const size_t m_capacity;
+        std::FILE *m_file = nullptr;
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_wake_cv;
+        std::condition_variable m_space_cv;
+        std::condition_variable m_done_cv;
+        std::deque<Record> m_queue;
+        size_t m_pushed = 0;
+        size_t m_written = 0;
+        bool m_stop = false;
+        bool m_failed = false;
+    };
+
+    std::atomic<bool> Recorder::s_started{false};
+
+    void _start_recording()
+    {
+        if (!static_publisher_options.record_path.empty())
+            Recorder::instance();
+    }
+
+    void flush_recording()
+    {
+        if (Recorder::started())
+            Recorder::instance().flush();
+    }
+
+    std::vector<RecordView> parse_record_log(const char *data, size_t size)
+    {
+        if (size < sizeof(record_log_magic) ||
+            std::memcmp(data, record_log_magic, sizeof(record_log_magic)) != 0)
+            throw std::runtime_error("Not a plotmsg recording.");
+
+        std::vector<RecordView> records;
+        size_t offset = sizeof(record_log_magic);
+        while (size - offset >= RecordHeader::encoded_size)
+        {
+            RecordHeader header;
+            header.size = _load_le<uint64_t>(data + offset);
+            header.time_ns = _load_le<int64_t>(data + offset + 8);
+            header.uuid_size = _load_le<uint32_t>(data + offset + 16);
+            header.num_frames = _load_le<uint32_t>(data + offset + 20);
+            const size_t end = offset + sizeof(header.size) + header.size;
+            // the last record might still be written
+            if (header.size > size || end > size)
+                break;
+            // every length within a complete record has to stay within it
+            auto check = [&offset, end](uint64_t length) {
+                if (length > end - offset)
+                    throw std::runtime_error("Corrupt record in a plotmsg recording.");
+            };
+            check(RecordHeader::encoded_size);
+            offset += RecordHeader::encoded_size;
+
+            RecordView record;
+            record.time_ns = header.time_ns;
+            check(header.uuid_size);
+            record.uuid.assign(data + offset, header.uuid_size);
+            offset += header.uuid_size;
+            for (uint32_t i = 0; i < header.num_frames; ++i)
+            {
+                check(sizeof(uint64_t));
+                const uint64_t frame_size = _load_le<uint64_t>(data + offset);
+                offset += sizeof(uint64_t);
+                check(frame_size);
+                record.frames.emplace_back(data + offset, frame_size);
+                offset += frame_size;
+            }
+            if (offset != end)
+                throw std::runtime_error("Corrupt record in a plotmsg recording.");
+            records.push_back(std::move(record));
+        }
+        return records;
+    }
+
+    ////////////////////////////////////////
+    // publisher statistics
+    ////////////////////////////////////////
+
+    struct AtomicHistogram
+    {
+        std::array<std::atomic<uint64_t>, Histogram::num_buckets> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+
+        void record(uint64_t value)
+        {
+            size_t bucket = 0;
+            while (bucket < 64 && (value >> bucket) != 0)
+                ++bucket;
+            buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+            uint64_t current = max.load(std::memory_order_relaxed);
+            while (value > current &&
+                   !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        Histogram snapshot() const
+        {
+            Histogram histogram;
+            for (size_t i = 0; i < Histogram::num_buckets; ++i)
+                histogram.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+            histogram.count = count.load(std::memory_order_relaxed);
+            histogram.sum = sum.load(std::memory_order_relaxed);
+            histogram.max = max.load(std::memory_order_relaxed);
+            return histogram;
+        }
+
+        void reset()
+        {
+            for (auto &&bucket : buckets)
+                bucket.store(0, std::memory_order_relaxed);
+            count.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+            max.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    struct AtomicFrameStats
+    {
+        std::atomic<uint64_t> frames_sent{0};
+        std::atomic<uint64_t> frames_dropped{0};
+        std::atomic<uint64_t> bytes_sent{0};
+        AtomicHistogram encode_ns;
+        AtomicHistogram send_ns;
+        AtomicHistogram payload_bytes;
+
+        FrameStats snapshot() const
+        {
+            FrameStats stats;
+            stats.frames_sent = frames_sent.load(std::memory_order_relaxed);
+            stats.frames_dropped = frames_dropped.load(std::memory_order_relaxed);
+            stats.bytes_sent = bytes_sent.load(std::memory_order_relaxed);
+            stats.encode_ns = encode_ns.snapshot();
+            stats.send_ns = send_ns.snapshot();
+            stats.payload_bytes = payload_bytes.snapshot();
+            return stats;
+        }
+
+        void reset()
+        {
+            frames_sent.store(0, std::memory_order_relaxed);
+            frames_dropped.store(0, std::memory_order_relaxed);
+            bytes_sent.store(0, std::memory_order_relaxed);
+            encode_ns.reset();
+            send_ns.reset();
+            payload_bytes.reset();
+        }
+    };
+
+    static AtomicFrameStats s_total_stats;
+    static AtomicHistogram s_queue_depth_stats;
+    static std::atomic<uint64_t> s_skipped_frames{0};
+    // entries are never removed (only reset), such that the threads can cache them
+    static std::mutex s_figure_stats_mutex;
+    static std::unordered_map<std::string, std::unique_ptr<AtomicFrameStats>> s_figure_stats;
+
+    AtomicFrameStats *_figure_stats(const MessageContainer &msg)
+    {
+        if (!msg.has_fig())
+            return nullptr;
+        // only the first message of a uuid on each thread takes the lock
+        thread_local std::unordered_map<std::string, AtomicFrameStats *> cache;
+        auto it = cache.find(msg.fig().uuid());
+        if (it != cache.end())
+            return it->second;
+
+        std::lock_guard<std::mutex> lock(s_figure_stats_mutex);
+        auto &stats = s_figure_stats[msg.fig().uuid()];
+        if (stats == nullptr)
+            stats = std::make_unique<AtomicFrameStats>();
+        return cache[msg.fig().uuid()] = stats.get();
+    }
+
+    void _record_dropped(const MessageContainer &msg)
+    {
+        s_total_stats.frames_dropped.fetch_add(1, std::memory_order_relaxed);
+        if (auto *figure_stats = _figure_stats(msg))
+            figure_stats->frames_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool _encode_and_publish(
+        MessageContainer &msg, zmq::send_flags send_flags,
+        const std::shared_ptr<google::protobuf::Arena> &arena
+    )
+    {
+        using clock = std::chrono::steady_clock;
+        auto *figure_stats = _figure_stats(msg);
+
+        const auto start = clock::now();
+        // reused, such that publishing does not allocate the list of frames every time
+        thread_local std::vector<zmq::message_t> frames;
+        _encode_message(msg, frames, arena);
+        const auto encoded = clock::now();
+        // zmq takes over the frames when sending them
+        size_t num_bytes = 0;
+        for (auto &&frame : frames)
+            num_bytes += frame.size();
+        if (Recorder::started())
+            Recorder::instance().push(msg, frames);
+        const bool sent =
+            static_publisher_options.record_only || publish_frames(frames, send_flags);
+        if (!sent && static_publisher_options.delta_updates && msg.has_fig())
+        {
+            // the next frame of this uuid cannot be a patch of a frame that was never sent
+            std::lock_guard<std::mutex> lock(s_sent_figures_mutex);
+            s_sent_figures.erase(msg.fig().uuid());
+        }
+        // frames that were not sent are released here (their slots are kept)
+        frames.clear();
+        const auto done = clock::now();
+
+        const uint64_t encode_ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(encoded - start).count();
+        const uint64_t send_ns =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(done - encoded).count();
+        for (auto *stats : {&s_total_stats, figure_stats})
+        {
+            if (stats == nullptr)
+                continue;
+            stats->encode_ns.record(encode_ns);
+            stats->send_ns.record(send_ns);
+            stats->payload_bytes.record(num_bytes);
+            if (sent)
+            {
+                stats->frames_sent.fetch_add(1, std::memory_order_relaxed);
+                stats->bytes_sent.fetch_add(num_bytes, std::memory_order_relaxed);
+            }
+            else
+                stats->frames_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        return sent;
+    }
+
+    ////////////////////////////////////////
+    // background publisher
+    ////////////////////////////////////////
+
+    struct PendingMessage
+    {
+        PendingMessage() = default;
 
-    void initialise_publisher(int sleep_after_bind, const std::string &addr)
+        PendingMessage(PendingMessage &&other) = default;
+
+        PendingMessage &operator=(PendingMessage &&other) noexcept
+        {
+            // the message might live on our arena, so it has to go first
+            msg.reset();
+            arena = std::move(other.arena);
+            msg = std::move(other.msg);
+            send_flags = other.send_flags;
+            sent = std::move(other.sent);
+            shared_series = std::move(other.shared_series);
+            return *this;
+        }
+
+        ~PendingMessage()
+        {
+            msg.reset();
+        }
+
+        std::shared_ptr<google::protobuf::Arena> arena;
+        MessagePtr<MessageContainer> msg;
+        zmq::send_flags send_flags = zmq::send_flags::none;
+        std::promise<bool> sent;
+        SharedSeriesList shared_series;
+    };
+
+    bool _conflates(const MessageContainer &msg)
     {
-        if (static_publisher != nullptr)
-            return;
-        static_context = std::make_unique<zmq::context_t>();
-        static_publisher = std::make_unique<zmq::socket_t>(*static_context, ZMQ_PUB);
-        static_publisher->bind(addr);
-        if (sleep_after_bind > 0)
-            std::this_thread::sleep_for(std::chrono::milliseconds(sleep_after_bind));
+        // extends cannot be replaced without losing their samples
+        return (static_publisher_options.conflate || static_publisher_options.max_rate_hz > 0) &&
+               msg.has_fig() && msg.fig().extends_size() == 0;
+    }
+
+    class AsyncPublisher
+    {
+    public:
+        static AsyncPublisher &instance()
+        {
+            static AsyncPublisher publisher;
+            return publisher;
+        }
+
+        static bool started()
+        {
+            return s_started.load(std::memory_order_acquire);
+        }
+
+        std::future<bool> push(PendingMessage &item)
+        {
+            if (_conflates(*item.msg))
+                return _hold(item);
+            auto result = item.sent.get_future();
+            size_t attempts = 0;
+            while (!m_queue.try_push(item))
+            {
+                switch (static_publisher_options.async_overflow_policy)
+                {
+                    case OverflowPolicy::drop_newest:
+                        _record_dropped(*item.msg);
+                        item.sent.set_value(false);
+                        return result;
+                    case OverflowPolicy::drop_oldest:
+                    {
+                        PendingMessage oldest;
+                        if (m_queue.try_pop(oldest))
+                        {
+                            _record_dropped(*oldest.msg);
+                            oldest.sent.set_value(false);
+                            _count_done();
+                        }
+                        break;
+                    }
+                    case OverflowPolicy::block:
+                        // back off while the publisher thread catches up
+                        if (++attempts < 64)
+                            std::this_thread::yield();
+                        else
+                            std::this_thread::sleep_for(std::chrono::microseconds(50));
+                        break;
+                }
+            }
+            s_queue_depth_stats.record(m_pushed.fetch_add(1) + 1 - m_done.load());
+            _wake_up();
+            return result;
+        }
+
+        bool flush(std::chrono::milliseconds timeout)
+        {
+            const size_t target = m_pushed.load();
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_flush_waiters.fetch_add(1);
+            auto is_done = [&] { return m_done.load() >= target; };
+            bool done;
+            if (timeout == std::chrono::milliseconds::max())
+            {
+                m_done_cv.wait(lock, is_done);
+                done = true;
+            }
+            else
+                done = m_done_cv.wait_for(lock, timeout, is_done);
+            m_flush_waiters.fetch_sub(1);
+            return done;
+        }
+
+        size_t conflated()
+        {
+            return m_conflated.load();
+        }
+
+        size_t queue_depth()
+        {
+            return m_pushed.load() - m_done.load();
+        }
+
+    private:
+        // the latest figure of a uuid that is held until the uuid is due
+        struct ConflationSlot
+        {
+            PendingMessage pending;
+            bool has_pending = false;
+            std::chrono::steady_clock::time_point next_due;
+        };
+
+        AsyncPublisher() : m_queue(static_publisher_options.async_queue_size)
+        {
+            m_thread = std::thread(&AsyncPublisher::run, this);
+            s_started.store(true, std::memory_order_release);
+        }
+
+        ~AsyncPublisher()
+        {
+            // publish whatever is still queued before stopping
+            m_stop.store(true);
+            _wake_up();
+            m_thread.join();
+            s_started.store(false, std::memory_order_release);
+        }
+
+        void run()
+        {
+            while (true)
+            {
+                PendingMessage item;
+                // held figures are all published when stopping
+                if (m_queue.try_pop(item) || _pop_due(item, m_stop.load()))
+                {
+                    try
+                    {
+                        item.sent.set_value(
+                            _encode_and_publish(*item.msg, item.send_flags, item.arena)
+                        );
+                    }
+                    catch (...)
+                    {
+                        item.sent.set_exception(std::current_exception());
+                    }
+                    _count_done();
+                    continue;
+                }
+                if (m_stop.load())
+                    break;
+
+                // nothing to do, sleep until a producer wakes us up or a held figure is due
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_sleeping.store(true);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (m_queue.size_approx() == 0 && !m_stop.load())
+                    m_wake_cv.wait_until(
+                        lock, std::min(
+                                  _next_due(),
+                                  std::chrono::steady_clock::now() + std::chrono::milliseconds(100)
+                              )
+                    );
+                m_sleeping.store(false);
+            }
+        }
+
+        std::future<bool> _hold(PendingMessage &item)
+        {
+            auto result = item.sent.get_future();
+            PendingMessage replaced;
+            bool has_replaced;
+            {
+                std::lock_guard<std::mutex> lock(m_conflation_mutex);
+                auto &slot = m_conflation_slots[item.msg->fig().uuid()];
+                has_replaced = slot.has_pending;
+                if (has_replaced)
+                    replaced = std::move(slot.pending);
+                slot.pending = std::move(item);
+                slot.has_pending = true;
+            }
+            s_queue_depth_stats.record(m_pushed.fetch_add(1) + 1 - m_done.load());
+            // the locks of the flush waiters and the publisher thread are taken outside of the
+            // conflation lock, which the publisher thread takes while holding m_mutex
+            if (has_replaced)
+            {
+                replaced.sent.set_value(false);
+                m_conflated.fetch_add(1);
+                _count_done();
+            }
+            _wake_up();
+            return result;
+        }
+
+        bool _pop_due(PendingMessage &item, bool ignore_rate)
+        {
+            const auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> lock(m_conflation_mutex);
+            for (auto &&kv_pair : m_conflation_slots)
+            {
+                auto &slot = kv_pair.second;
+                if (slot.has_pending && (ignore_rate || slot.next_due <= now))
+                {
+                    item = std::move(slot.pending);
+                    slot.has_pending = false;
+                    slot.next_due = now;
+                    if (static_publisher_options.max_rate_hz > 0)
+                        slot.next_due += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::duration<double>(1 / static_publisher_options.max_rate_hz)
+                        );
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::chrono::steady_clock::time_point _next_due()
+        {
+            auto next_due = std::chrono::steady_clock::time_point::max();
+            std::lock_guard<std::mutex> lock(m_conflation_mutex);
+            for (auto &&kv_pair : m_conflation_slots)
+            {
+                if (kv_pair.second.has_pending)
+                    next_due = std::min(next_due, kv_pair.second.next_due);
+            }
+            return next_due;
+        }
+
+        void _wake_up()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_sleeping.load())
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_wake_cv.notify_one();
+            }
+        }
+
+        void _count_done()
+        {
+            m_done.fetch_add(1);
+            if (m_flush_waiters.load() > 0)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done_cv.notify_all();
+            }
+        }
+
+        static std::atomic<bool> s_started;
+
+        BoundedQueue<PendingMessage> m_queue;
+        std::thread m_thread;
+        std::atomic<bool> m_stop{false};
+        std::atomic<bool> m_sleeping{false};
+        std::atomic<size_t> m_pushed{0};
+        std::atomic<size_t> m_done{0};
+        std::atomic<int> m_flush_waiters{0};
+        std::mutex m_mutex;
+        std::condition_variable m_wake_cv;
+        std::condition_variable m_done_cv;
+
+        std::mutex m_conflation_mutex;
+        std::unordered_map<std::string, ConflationSlot> m_conflation_slots;
+        std::atomic<size_t> m_conflated{0};
+    };
+
+    std::atomic<bool> AsyncPublisher::s_started{false};
+
+    bool _skip_message(const MessageContainer &msg)
+    {
+#ifdef PLOTMSG_DISABLE
+        return true;
+#else
+        if (!static_publisher_options.skip_without_subscribers ||
+            !static_publisher_options.track_subscribers)
+            return false;
+        if (num_subscriptions() == 0)
+            return true;
+        return static_publisher_options.topic_frames && !_has_subscription(message_topic(msg));
+#endif
+    }
+
+    std::future<bool> publish_message_async(
+        MessagePtr<MessageContainer> msg, std::shared_ptr<google::protobuf::Arena> arena,
+        zmq::send_flags send_flags, SharedSeriesList shared_series
+    )
+    {
+        if (_skip_message(*msg))
+        {
+            s_skipped_frames.fetch_add(1, std::memory_order_relaxed);
+            // the message might live on the arena, so it has to go first
+            msg.reset();
+            arena.reset();
+            std::promise<bool> skipped;
+            skipped.set_value(false);
+            return skipped.get_future();
+        }
+        PendingMessage item;
+        item.arena = std::move(arena);
+        item.msg = std::move(msg);
+        item.send_flags = send_flags;
+        item.shared_series = std::move(shared_series);
+        return AsyncPublisher::instance().push(item);
+    }
+
+    bool _hands_over(const MessageContainer &msg)
+    {
+        // whether msg is handed over to the publisher thread rather than encoded by the caller
+        // (with multiple producers every thread has its own socket, so it encodes right away)
+        return _conflates(msg) || (AsyncPublisher::started() && s_fan_in == nullptr);
+    }
+
+    bool _publish_message(
+        MessageContainer &msg, zmq::send_flags send_flags, SharedSeriesList shared_series,
+        const std::shared_ptr<google::protobuf::Arena> &arena
+    )
+    {
+        if (_skip_message(msg))
+        {
+            s_skipped_frames.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (_hands_over(msg))
+        {
+            // the message is moved into one of our own, which copies it if it lives on an
+            // arena (figures hand over their arena with the message instead, see send_async)
+            const bool conflates = _conflates(msg);
+            MessagePtr<MessageContainer> owned(new MessageContainer());
+            owned->Swap(&msg);
+            auto sent = publish_message_async(
+                std::move(owned), nullptr, send_flags, std::move(shared_series)
+            );
+            // a conflated message is held until its uuid is due, without waiting for it
+            return conflates || sent.get();
+        }
+        return _encode_and_publish(msg, send_flags, arena);
+    }
+
+    bool publish_message(
+        MessageContainer &msg, zmq::send_flags send_flags, SharedSeriesList shared_series
+    )
+    {
+        return _publish_message(msg, send_flags, std::move(shared_series), nullptr);
+    }
+
+    bool flush(std::chrono::milliseconds timeout)
+    {
+        if (!AsyncPublisher::started())
+            return true;
+        return AsyncPublisher::instance().flush(timeout);
+    }
+
+    size_t conflated_frames()
+    {
+        if (!AsyncPublisher::started())
+            return 0;
+        return AsyncPublisher::instance().conflated();
+    }
+
+    uint64_t Histogram::percentile(double p) const
+    {
+        const uint64_t rank = static_cast<uint64_t>(std::ceil(p * count));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < num_buckets; ++i)
+        {
+            seen += buckets[i];
+            if (seen >= rank && seen > 0)
+                return i == 0 ? 0 : std::min(max, (uint64_t(1) << (i - 1)) * 2 - 1);
+        }
+        return max;
+    }
+
+    PublisherStats stats()
+    {
+        PublisherStats stats;
+        stats.total = s_total_stats.snapshot();
+        {
+            std::lock_guard<std::mutex> lock(s_figure_stats_mutex);
+            for (auto &&kv_pair : s_figure_stats)
+                stats.figures[kv_pair.first] = kv_pair.second->snapshot();
+        }
+        if (AsyncPublisher::started())
+            stats.queue_depth = AsyncPublisher::instance().queue_depth();
+        stats.queue_depth_at_push = s_queue_depth_stats.snapshot();
+        stats.frames_conflated = conflated_frames();
+        stats.frames_skipped = s_skipped_frames.load(std::memory_order_relaxed);
+        stats.num_subscriptions = num_subscriptions();
+        return stats;
+    }
+
+    void reset_stats()
+    {
+        s_total_stats.reset();
+        s_queue_depth_stats.reset();
+        s_skipped_frames.store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(s_figure_stats_mutex);
+        for (auto &&kv_pair : s_figure_stats)
+            kv_pair.second->reset();
+    }
+
+    class StatsDumper
+    {
+    public:
+        static StatsDumper &instance()
+        {
+            static StatsDumper dumper;
+            return dumper;
+        }
+
+        void set(
+            std::chrono::milliseconds period, std::function<void(const PublisherStats &)> callback
+        )
+        {
+            stop();
+            if (period.count() <= 0)
+                return;
+            m_stop = false;
+            m_thread = std::thread([this, period, callback] {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (!m_cv.wait_for(lock, period, [this] { return m_stop; }))
+                {
+                    if (callback)
+                        callback(stats());
+                    else
+                        std::cerr << stats() << std::endl;
+                }
+            });
+        }
+
+        ~StatsDumper()
+        {
+            stop();
+        }
+
+    private:
+        void stop()
+        {
+            if (!m_thread.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_all();
+            m_thread.join();
+        }
+
+        std::thread m_thread;
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        bool m_stop = false;
+    };
+
+    void dump_stats_every(
+        std::chrono::milliseconds period, std::function<void(const PublisherStats &)> callback
+    )
+    {
+        StatsDumper::instance().set(period, std::move(callback));
+    }
+
+    std::ostream &_print_frame_stats(std::ostream &out, const FrameStats &stats)
+    {
+        auto print_histogram = [&out](const char *name, const Histogram &histogram) {
+            out << " " << name << "(p50/p99/p999/max)=" << histogram.percentile(0.5) << "/"
+                << histogram.percentile(0.99) << "/" << histogram.percentile(0.999) << "/"
+                << histogram.max;
+        };
+        out << "sent=" << stats.frames_sent << " dropped=" << stats.frames_dropped
+            << " bytes=" << stats.bytes_sent;
+        print_histogram("encode_ns", stats.encode_ns);
+        print_histogram("send_ns", stats.send_ns);
+        print_histogram("payload_bytes", stats.payload_bytes);
+        return out;
+    }
+
+    std::ostream &operator<<(std::ostream &out, const PublisherStats &stats)
+    {
+        out << "PublisherStats<queue_depth=" << stats.queue_depth
+            << " conflated=" << stats.frames_conflated << " skipped=" << stats.frames_skipped
+            << " subscriptions=" << stats.num_subscriptions << "\n  total: ";
+        _print_frame_stats(out, stats.total);
+        for (auto &&kv_pair : stats.figures)
+        {
+            out << "\n  " << kv_pair.first << ": ";
+            _print_frame_stats(out, kv_pair.second);
+        }
+        out << ">";
+        return out;
     }
 
     ////////////////////////////////////////
@@ -26,23 +2300,29 @@ namespace PlotMsg
          */
         for (auto &&it = ori_dict.begin(); it != ori_dict.end(); ++it)
         {
-            auto key = it->first;
-            auto itemVal = it->second;
+            const auto &key = it->first;
+            const auto &itemVal = it->second;
 
             if (itemVal.value_case() == DictItemValMsg::kSeriesD)
             {
-                // TODO
-                auto *series_d = new SeriesDMsg();
-                series_d->ParseFromString(itemVal.series_d().SerializeAsString());
-                new_dict[key].set_allocated_series_d(series_d);
+                new_dict[key].mutable_series_d()->CopyFrom(itemVal.series_d());
             }
             else if (itemVal.value_case() == DictItemValMsg::kSeriesI)
             {
-                // TODO
-                auto *series_i = new SeriesIMsg();
-                series_i->ParseFromString(itemVal.series_i().SerializeAsString());
-                new_dict[key].set_allocated_series_i(series_i);
-                itemVal.series_i().New(itemVal.GetArena());
+                new_dict[key].mutable_series_i()->CopyFrom(itemVal.series_i());
+            }
+            else if (itemVal.value_case() == DictItemValMsg::kNdarray)
+            {
+                new_dict[key].mutable_ndarray()->CopyFrom(itemVal.ndarray());
+            }
+            else if (itemVal.value_case() == DictItemValMsg::kSegments)
+            {
+                new_dict[key].mutable_segments()->CopyFrom(itemVal.segments());
+            }
+            else if (itemVal.value_case() == DictItemValMsg::kSharedSeries)
+            {
+                // immutable, hence the copy refers to the same series
+                new_dict[key].set_shared_series(itemVal.shared_series());
             }
             else if (itemVal.value_case() == DictItemValMsg::kBool)
             {
@@ -58,6 +2338,18 @@ namespace PlotMsg
             {
                 _set_DictItemVal(new_dict[key], itemVal.double_());
             }
+            else if (itemVal.value_case() == DictItemValMsg::kInt)
+            {
+                _set_DictItemVal(new_dict[key], itemVal.int_());
+            }
+            else if (itemVal.value_case() == DictItemValMsg::kInt64)
+            {
+                new_dict[key].set_int64(itemVal.int64());
+            }
+            else if (itemVal.value_case() == DictItemValMsg::kUint64)
+            {
+                new_dict[key].set_uint64(itemVal.uint64());
+            }
             else if (itemVal.value_case() == DictItemValMsg::kString)
             {
                 std::string new_str = itemVal.string();
@@ -77,51 +2369,200 @@ namespace PlotMsg
     // implementation of PlotMsg Figure
     ////////////////////////////////////////
 
-    void Figure::send(zmq::send_flags send_flags)
+    Figure::Figure(const Figure &fig) : Figure(fig.m_uuid, fig.m_arena != nullptr)
+    {
+        m_msg->CopyFrom(*fig.m_msg);
+        m_shared_series = fig.m_shared_series;
+        m_persistent = fig.m_persistent;
+        m_traces.reserve(fig.size());
+        for (auto &&trace : fig.m_traces)
+        {
+            // copied straight onto our own arena (if any)
+            _add_trace();
+            Trace &copy = m_traces.back();
+            copy.m_method = trace.m_method;
+            copy.m_method_func = trace.m_method_func;
+            copy.m_kwargs.m_msg->CopyFrom(*trace.m_kwargs.m_msg);
+            copy.m_kwargs.m_shared_series = trace.m_kwargs.m_shared_series;
+        }
+    }
+
+    Figure &Figure::operator=(const Figure &fig)
+    {
+        if (this != &fig)
+            *this = Figure(fig);
+        return *this;
+    }
+
+    Figure &Figure::operator=(Figure &&fig) noexcept
+    {
+        if (this == &fig)
+            return *this;
+        // everything that might live on our arena must go before the arena itself
+        m_traces.clear();
+        m_msg.reset();
+        m_arena = std::move(fig.m_arena);
+        m_msg = std::move(fig.m_msg);
+        m_traces = std::move(fig.m_traces);
+        m_uuid = std::move(fig.m_uuid);
+        m_shared_series = std::move(fig.m_shared_series);
+        m_persistent = fig.m_persistent;
+        return *this;
+    }
+
+    void Figure::_pack_traces(bool lend)
     {
-        initialise_publisher();
         // swap kwargs in the dictionary container with the protobuf internal msg
-        auto _fig = m_msg.mutable_fig();
+        auto _fig = m_msg->mutable_fig();
         _fig->set_uuid(m_uuid);
 
+        // the slots of the last frame are reused by persistent figures
+        while (_fig->traces_size() > static_cast<int>(size()))
+            _fig->mutable_traces()->RemoveLast();
         for (uint i = 0; i < size(); ++i)
         {
-            auto trace = _fig->add_traces();
-            trace->mutable_kwargs()->Swap(m_traces[i].m_kwargs.release_ptr());
+            auto trace = static_cast<int>(i) < _fig->traces_size() ? _fig->mutable_traces(i)
+                                                                   : _fig->add_traces();
+            Dictionary &kwargs = m_traces[i].m_kwargs;
+            _hold_shared_series(m_shared_series, kwargs.m_shared_series);
+            // (Swap would copy kwargs of another arena, e.g. heap traces of an arena figure)
+            if (kwargs.m_msg->GetArena() == trace->GetArena())
+                trace->mutable_kwargs()->Swap(kwargs.m_msg.get());
+            else if (lend)
+                trace->unsafe_arena_set_allocated_kwargs(kwargs.m_msg.get());
+            else
+            {
+                // owned by the arena of the message from now on
+                trace->set_allocated_kwargs(kwargs.m_msg.release());
+                kwargs.reset();
+            }
             trace->set_method(m_traces[i].m_method);
             trace->set_method_func(m_traces[i].m_method_func);
         }
+    }
 
-        std::string encoded_msg;
-        m_msg.SerializeToString(&encoded_msg);
-        zmq::message_t zmq_msg(encoded_msg.size());
-        memcpy((void *)zmq_msg.data(), encoded_msg.c_str(), encoded_msg.size());
-        static_publisher->send(zmq_msg, send_flags);
+    ExtendTraceMsg *Figure::_extend_trace_msg(uint idx, size_t max_points)
+    {
+        auto _fig = m_msg->mutable_fig();
+        for (auto &&extend : *_fig->mutable_extends())
+        {
+            if (extend.trace() == idx)
+            {
+                extend.set_max_points(max_points);
+                return &extend;
+            }
+        }
+        auto extend = _fig->add_extends();
+        extend->set_trace(idx);
+        extend->set_max_points(max_points);
+        return extend;
+    }
 
-        reset();
+    void Figure::_unpack_traces()
+    {
+        auto _fig = m_msg->mutable_fig();
+        for (uint i = 0; i < size() && static_cast<int>(i) < _fig->traces_size(); ++i)
+        {
+            auto *trace = _fig->mutable_traces(i);
+            DictionaryMsg *kwargs = m_traces[i].m_kwargs.m_msg.get();
+            // the kwargs that were lent by _pack_traces are taken back
+            if (trace->has_kwargs() && &trace->kwargs() == kwargs)
+                trace->unsafe_arena_release_kwargs();
+            else
+                trace->mutable_kwargs()->Swap(kwargs);
+        }
+        _fig->mutable_commands()->Clear();
+        _fig->mutable_extends()->Clear();
+        _fig->set_patch(false);
     }
 
-    void Figure::reset()
+    bool _publishes_in_place(const MessageContainer &msg)
     {
-        m_msg.Clear();
-        m_traces.clear();
-        m_msg.set_allocated_fig(new PlotlyFigureMsg());
-        set_uuid(m_uuid);
+        // whether publishing msg leaves it as it is, rather than reducing it to a patch,
+        // moving its series out or handing it over to the background publisher
+        return !static_publisher_options.delta_updates &&
+               static_publisher_options.multipart_threshold == 0 &&
+               static_publisher_options.shm_threshold == 0 &&
+               !static_publisher_options.dedup_series && !_hands_over(msg);
+    }
+
+    void Figure::send(zmq::send_flags send_flags)
+    {
+#ifdef PLOTMSG_DISABLE
+        // nothing is published, hence the traces are not even packed into the message
+        (void)send_flags;
+        if (m_persistent)
+            _unpack_traces();
+        else
+            reset();
+#else
+        _ensure_publisher();
+        m_msg->mutable_fig()->set_uuid(m_uuid);
+        if (_hands_over(*m_msg))
+        {
+            // handed over together with the arena it lives on, rather than copied
+            const bool conflates = _conflates(*m_msg);
+            auto sent = send_async(send_flags);
+            if (!conflates)
+                sent.wait();
+            return;
+        }
+        // the frame is only kept if publishing leaves it intact (rather than copying it)
+        const bool keep = m_persistent && _publishes_in_place(*m_msg);
+        _pack_traces(keep);
+        if (!keep)
+        {
+            // the frames of multipart messages might still point into the arena, hence it
+            // is only reused by reset() once zmq has sent them
+            _publish_message(*m_msg, send_flags, std::move(m_shared_series), m_arena);
+            reset();
+            return;
+        }
+
+        _publish_message(*m_msg, send_flags, m_shared_series, m_arena);
+        _unpack_traces();
+#endif
     }
 
-    zmq::message_t Figure::build_zmq_msg()
+    std::future<bool> Figure::send_async(zmq::send_flags send_flags)
     {
-        // serial protobuf to string
-        std::string encoded_msg;
+#ifdef PLOTMSG_DISABLE
+        send(send_flags);
+        std::promise<bool> skipped;
+        skipped.set_value(false);
+        return skipped.get_future();
+#else
+        _ensure_publisher();
+        _pack_traces(false);
+        // the frame is handed over, hence even a persistent figure starts over (see
+        // PublisherOptions), and the (now empty) traces might live on the arena
+        m_traces.clear();
+
+        const bool use_arena = m_arena != nullptr;
+        auto sent = publish_message_async(
+            std::move(m_msg), std::move(m_arena), send_flags, std::move(m_shared_series)
+        );
+        if (use_arena)
+            m_arena = std::make_shared<google::protobuf::Arena>();
+        reset();
+        return sent;
+#endif
+    }
 
-        std::cout << "|>" << m_msg.mutable_fig()->mutable_traces()->Get(0).kwargs().data()
-                  << std::endl;
-        m_msg.SerializeToString(&encoded_msg);
-        // memcpy to a zmq m_msg
-        std::cout << "size   " << encoded_msg.size() << std::endl;
-        zmq::message_t zmq_msg(encoded_msg.size());
-        memcpy((void *)zmq_msg.data(), encoded_msg.c_str(), encoded_msg.size());
-        return zmq_msg;
+    void Figure::reset()
+    {
+        // the traces and the message might live on the arena, so they go first
+        m_traces.clear();
+        m_msg.reset();
+        // frames that zmq has not sent yet might still point into the arena
+        if (m_arena && m_arena.use_count() > 1)
+            m_arena = std::make_shared<google::protobuf::Arena>();
+        else if (m_arena)
+            m_arena->Reset();
+        m_msg.reset(google::protobuf::Arena::CreateMessage<MessageContainer>(m_arena.get()));
+        m_msg->mutable_fig();
+        m_shared_series.clear();
+        set_uuid(m_uuid);
     }
 
     std::ostream &operator<<(std::ostream &out, Figure const &fig)
@@ -156,7 +2597,7 @@ namespace PlotMsg
 
     int Figure::_add_trace()
     {
-        m_traces.emplace_back();
+        m_traces.emplace_back(m_arena.get());
         return size();
     }
 
@@ -179,9 +2620,10 @@ namespace PlotMsg
 
     void Figure::add_command(const std::string &func, Dictionary &value)
     {
-        auto cmd = m_msg.mutable_fig()->add_commands();
+        auto cmd = m_msg->mutable_fig()->add_commands();
         cmd->set_func(func);
-        cmd->mutable_kwargs()->Swap(value.release_ptr());
+        cmd->mutable_kwargs()->Swap(value.m_msg.get());
+        _hold_shared_series(m_shared_series, value.m_shared_series);
     }
 
     void Figure::add_command(const std::string &func, Dictionary &&value)
@@ -193,38 +2635,58 @@ namespace PlotMsg
     ////////////////////////////////////////
     // Helpers
     ////////////////////////////////////////
-    SeriesDMsg *vec_to_allocated_seriesD(std::vector<double> value)
+    // the series are filled in place, such that their storage lives on the same arena
+    SeriesDMsg *
+    vec_to_allocated_seriesD(const std::vector<double> &value, google::protobuf::Arena *arena)
     {
-        google::protobuf::RepeatedField<double> data(value.begin(), value.end());
-        auto *series = new SeriesDMsg();
-        series->mutable_data()->Swap(&data);
+        auto *series = google::protobuf::Arena::CreateMessage<SeriesDMsg>(arena);
+        series->mutable_data()->Add(value.begin(), value.end());
         return series;
     }
 
-    SeriesIMsg *vec_to_allocated_seriesI(std::vector<int> value)
+    SeriesIMsg *
+    vec_to_allocated_seriesI(const std::vector<int> &value, google::protobuf::Arena *arena)
     {
-        google::protobuf::RepeatedField<int> data(value.begin(), value.end());
-        auto *series = new SeriesIMsg();
-        series->mutable_data()->Swap(&data);
+        auto *series = google::protobuf::Arena::CreateMessage<SeriesIMsg>(arena);
+        series->mutable_data()->Add(value.begin(), value.end());
         return series;
     }
 
-    SeriesStringMsg *vec_to_allocated_seriesString(std::vector<std::string> value)
+    SeriesStringMsg *
+    vec_to_allocated_seriesString(std::vector<std::string> value, google::protobuf::Arena *arena)
     {
-        google::protobuf::RepeatedPtrField<std::string> data(value.begin(), value.end());
-        auto *series = new SeriesStringMsg();
-        series->mutable_data()->Swap(&data);
+        auto *series = google::protobuf::Arena::CreateMessage<SeriesStringMsg>(arena);
+        auto *data = series->mutable_data();
+        data->Reserve(value.size());
+        for (auto &&str : value)
+            data->Add(std::move(str));
         return series;
     }
 
-    SeriesAnyMsg *vec_to_allocated_seriesAny(std::vector<SeriesAnyMsg_value> value)
+    SeriesAnyMsg *vec_to_allocated_seriesAny(
+        std::vector<SeriesAnyMsg_value> value, google::protobuf::Arena *arena
+    )
     {
-        google::protobuf::RepeatedPtrField<SeriesAnyMsg_value> data(value.begin(), value.end());
-        auto *series = new SeriesAnyMsg();
-        series->mutable_data()->Swap(&data);
+        auto *series = google::protobuf::Arena::CreateMessage<SeriesAnyMsg>(arena);
+        auto *data = series->mutable_data();
+        data->Reserve(value.size());
+        for (auto &&val : value)
+            data->Add()->Swap(&val);
         return series;
     }
 
+    NDArrayMsg *raw_to_allocated_ndarray(
+        DType dtype, const void *data, size_t num_bytes, const std::vector<size_t> &shape,
+        google::protobuf::Arena *arena
+    )
+    {
+        auto *array = google::protobuf::Arena::CreateMessage<NDArrayMsg>(arena);
+        array->set_dtype(dtype);
+        array->mutable_shape()->Add(shape.begin(), shape.end());
+        array->set_data(data, num_bytes);
+        return array;
+    }
+
     void _set_DictItemVal(DictItemValMsg &item_val, NullValueType null)
     {
         item_val.set_null(null);
@@ -245,29 +2707,115 @@ namespace PlotMsg
         item_val.set_int_(value);
     }
 
+    // a series that is already there is overwritten in place, keeping its capacity
     void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<double> &value)
     {
-        item_val.set_allocated_series_d(vec_to_allocated_seriesD(value));
+        auto *data = item_val.mutable_series_d()->mutable_data();
+        data->Clear();
+        data->Add(value.begin(), value.end());
     }
 
     void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<int> &value)
     {
-        item_val.set_allocated_series_i(vec_to_allocated_seriesI(value));
+        auto *data = item_val.mutable_series_i()->mutable_data();
+        data->Clear();
+        data->Add(value.begin(), value.end());
+    }
+
+    void _set_ndarray(
+        DictItemValMsg &item_val, DType dtype, const void *data, size_t num_bytes,
+        const size_t *shape, size_t ndim
+    )
+    {
+        auto *array = item_val.mutable_ndarray();
+        array->set_dtype(dtype);
+        array->mutable_shape()->Clear();
+        array->mutable_shape()->Add(shape, shape + ndim);
+        array->mutable_data()->assign(static_cast<const char *>(data), num_bytes);
     }
 
     void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<std::string> &value)
     {
-        item_val.set_allocated_series_string(vec_to_allocated_seriesString(value));
+        item_val.set_allocated_series_string(
+            vec_to_allocated_seriesString(value, item_val.GetArena())
+        );
+    }
+
+    void _set_DictItemVal(DictItemValMsg &item_val, std::vector<std::string> &&value)
+    {
+        item_val.set_allocated_series_string(
+            vec_to_allocated_seriesString(std::move(value), item_val.GetArena())
+        );
     }
 
     void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<SeriesAnyMsg_value> &value)
     {
-        item_val.set_allocated_series_any(vec_to_allocated_seriesAny(value));
+        item_val.set_allocated_series_any(vec_to_allocated_seriesAny(value, item_val.GetArena()));
+    }
+
+    void _set_DictItemVal(DictItemValMsg &item_val, std::vector<SeriesAnyMsg_value> &&value)
+    {
+        item_val.set_allocated_series_any(
+            vec_to_allocated_seriesAny(std::move(value), item_val.GetArena())
+        );
+    }
+
+    void _set_DictItemVal(DictItemValMsg &item_val, google::protobuf::RepeatedField<double> &&value)
+    {
+        auto *series = google::protobuf::Arena::CreateMessage<SeriesDMsg>(item_val.GetArena());
+        series->mutable_data()->Swap(&value);
+        item_val.set_allocated_series_d(series);
+    }
+
+    void _set_DictItemVal(DictItemValMsg &item_val, google::protobuf::RepeatedField<int32_t> &&value)
+    {
+        auto *series = google::protobuf::Arena::CreateMessage<SeriesIMsg>(item_val.GetArena());
+        series->mutable_data()->Swap(&value);
+        item_val.set_allocated_series_i(series);
+    }
+
+    void _set_DictItemVal(DictItemValMsg &item_val, const std::vector<bool> &value)
+    {
+        auto *array = google::protobuf::Arena::CreateMessage<NDArrayMsg>(item_val.GetArena());
+        array->set_dtype(DTYPE_BOOL);
+        array->add_shape(value.size());
+        // one bit per element, least significant bit first
+        auto *bits = array->mutable_data();
+        bits->assign((value.size() + 7) / 8, '\0');
+        for (size_t i = 0; i < value.size(); ++i)
+            if (value[i])
+                (*bits)[i / 8] |= static_cast<char>(1 << (i % 8));
+        item_val.set_allocated_ndarray(array);
+    }
+
+    void _set_DictItemVal(DictItemValMsg &item_val, const SharedSeries &value)
+    {
+        item_val.set_shared_series(value.id);
+    }
+
+    void _hold_shared_series(SharedSeriesList &list, const SharedSeries &value)
+    {
+        if (std::find(list.begin(), list.end(), value.array) == list.end())
+            list.push_back(value.array);
+    }
+
+    void _hold_shared_series(SharedSeriesList &list, const SharedSeriesList &other)
+    {
+        for (auto &&array : other)
+            if (std::find(list.begin(), list.end(), array) == list.end())
+                list.push_back(array);
+    }
+
+    void _hold_shared_series(SharedSeriesList &list, const PlotMsg::Dictionary &value)
+    {
+        _hold_shared_series(list, value.m_shared_series);
     }
 
     void _set_DictItemVal(DictItemValMsg &item_val, PlotMsg::Dictionary &value)
     {
+        // the given dictionary is left empty, but usable
         item_val.set_allocated_dict(value.release_ptr());
+        value.reset();
     }
 
     // r-value, uses l-value definition
@@ -288,7 +2836,7 @@ namespace PlotMsg
                 out << ", ";
 
             out << it->first << ":";
-            auto itemVal = it->second;
+            const auto &itemVal = it->second;
 
             switch (itemVal.value_case())
             {
@@ -304,6 +2852,18 @@ namespace PlotMsg
                 case DictItemValMsg::kSeriesAny:
                     out << "seriesAny<..>";
                     break;
+                case DictItemValMsg::kNdarray:
+                    out << "ndarray<..>";
+                    break;
+                case DictItemValMsg::kSegments:
+                    out << "segments<..>";
+                    break;
+                case DictItemValMsg::kSharedSeries:
+                    out << "shared<" << itemVal.shared_series() << ">";
+                    break;
+                case DictItemValMsg::kSeriesRef:
+                    out << "ref<" << itemVal.series_ref() << ">";
+                    break;
                 case DictItemValMsg::kBool:
                     out << itemVal.bool_();
                     break;
@@ -316,6 +2876,12 @@ namespace PlotMsg
                 case DictItemValMsg::kInt:
                     out << itemVal.int_();
                     break;
+                case DictItemValMsg::kInt64:
+                    out << itemVal.int64();
+                    break;
+                case DictItemValMsg::kUint64:
+                    out << itemVal.uint64();
+                    break;
                 case DictItemValMsg::kString:
                     out << itemVal.string();
                     break;
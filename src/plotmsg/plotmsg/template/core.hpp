@@ -2,6 +2,7 @@
 
 #include "plotmsg/main.hpp"
 
+#include <array>
 #include <cmath>
 
 /*
@@ -72,6 +73,18 @@ namespace PlotMsg
             return trace;
         }
 
+        void _set_contour_style(PlotMsg::Trace &trace, bool label, bool continuous_coloring)
+        {
+            if (continuous_coloring)
+                trace["contours_coloring"] = "heatmap";  // can also be 'lines', or 'none'
+            if (label)
+            {
+                trace["contours_showlabels"] = true;
+                trace["contours_labelfont_size"] = 12;
+                trace["contours_labelfont_color"] = "white";
+            }
+        }
+
         template <typename T>
         PlotMsg::Trace contour(
             std::vector<T> &x, std::vector<T> &y, std::vector<T> &c, bool label = false,
@@ -86,14 +99,26 @@ namespace PlotMsg
                     "z", c            //
                 )
             );
-            if (continuous_coloring)
-                trace["contours_coloring"] = "heatmap";  // can also be 'lines', or 'none'
-            if (label)
-            {
-                trace["contours_showlabels"] = true;
-                trace["contours_labelfont_size"] = 12;
-                trace["contours_labelfont_color"] = "white";
-            }
+            _set_contour_style(trace, label, continuous_coloring);
+            return trace;
+        }
+
+        // z is a grid of shape (y.size(), x.size()), which is sent as a shaped array
+        template <typename T>
+        PlotMsg::Trace contour(
+            std::vector<T> &x, std::vector<T> &y, const NDArray<T> &z, bool label = false,
+            bool continuous_coloring = false
+        )
+        {
+            auto trace = PlotMsg::Trace(  //
+                PlotlyTrace::graph_objects, "Contour",
+                PlotMsg::Dictionary(  //
+                    "x", x,           //
+                    "y", y,           //
+                    "z", z            //
+                )
+            );
+            _set_contour_style(trace, label, continuous_coloring);
             return trace;
         }
 
@@ -110,54 +135,48 @@ namespace PlotMsg
             );
         }
 
+        // z is a grid of shape (y.size(), x.size()), which is sent as a shaped array
+        template <typename T>
+        PlotMsg::Trace heatmap(std::vector<T> &x, std::vector<T> &y, const NDArray<T> &z)
+        {
+            return PlotMsg::Trace(
+                PlotlyTrace::graph_objects, "Heatmap",
+                PlotMsg::Dictionary(  //
+                    "x", x,           //
+                    "y", y,           //
+                    "z", z            //
+                )
+            );
+        }
+
         /**
          * Plot the given list of edges
          * @tparam T data type of the container (should be able to infer this)
          * @param pair_of_edges_across_dim a list of d-dimensional pair of edges. E.g.,
          *        [x~[[1, 2], [3, 4]], y~[[5, 6], [7, 8]]] represents a 2D edge list with
          *        data point (1,5) connects to (2,6) and (3, 7) connects to (4,8)
+         * @param as_float32 send the endpoints as float32 (8 bytes per edge and dimension)
          * @return a trace that contain the formatted edges
          */
         template <size_t StateDimNum, typename T>
-        PlotMsg::Trace
-        edges(const std::array<std::vector<std::pair<T, T>>, StateDimNum> &pair_of_edges_across_dim)
+        PlotMsg::Trace edges(
+            const std::array<std::vector<std::pair<T, T>>, StateDimNum> &pair_of_edges_across_dim,
+            bool as_float32 = true
+        )
         {
             static_assert(StateDimNum == 2 || StateDimNum == 3, "Not supported");
 
-            // x's size is used as the final size
-            size_t _reference_size = pair_of_edges_across_dim[0].size();
-
-            std::vector<std::vector<SeriesAnyMsg_value>> edge_series;
-            std::vector<double> edge_weight;
-            edge_series.resize(StateDimNum);
-            for (int d = 0; d < StateDimNum; ++d)
-            {
-                edge_series[d].reserve(_reference_size);
-            }
-
-            for (uint i = 0; i < _reference_size; ++i)
-            {
-                for (int d = 0; d < StateDimNum; ++d)
-                {
-                    seriesAny_vector_push_back(
-                        edge_series[d], pair_of_edges_across_dim[d][i].first
-                    );
-                    seriesAny_vector_push_back(
-                        edge_series[d], pair_of_edges_across_dim[d][i].second
-                    );
-                    seriesAny_vector_push_back(edge_series[d], PlotMsg::NullValue);
-                }
-            }
-
             PlotMsg::Trace trace;
             if (StateDimNum == 2)
-            {
-                trace = scatter(edge_series[0], edge_series[1]);
-            }
+                trace = scatter();
             else if (StateDimNum == 3)
-            {
-                trace = scatter(edge_series[0], edge_series[1], edge_series[2]);
-            }
+                trace = PlotMsg::Trace(PlotlyTrace::graph_objects, "Scatter3d");
+
+            // the endpoints are packed, and separated into lines by the receiver
+            const char *keys[] = {"x", "y", "z"};
+            for (size_t d = 0; d < StateDimNum; ++d)
+                trace[keys[d]] = PlotMsg::segments(pair_of_edges_across_dim[d], as_float32);
+
             trace.m_kwargs.update_kwargs(PlotMsg::Dictionary(  //
                 "line_width", 0.5,                             //
                 "line_color", "#888",                          //
@@ -94,6 +94,9 @@ namespace PlotMsg
             StateTransformationFunc_t<StateDimNum, T> transformation_func
         )
         {
+            // the graph can be large, so skip walking it when nobody would see it
+            if (!PlotMsg::has_listeners())
+                return;
             bool plot_edge_color = false;
             std::vector<double> edge_color;
             std::shared_ptr<ompl::base::Cost> weight;
@@ -177,6 +180,8 @@ namespace PlotMsg
             PlotMsg::Figure &fig, const ob::PlannerData &data, const StateFormatterType &formatter
         )
         {
+            if (!PlotMsg::has_listeners())
+                return;
             //            static_assert(
             //                std::is_base_of_v<StateFormatterType, StateFormatter<StateDimNum, T>>,
             //                // "Incorrect Type"
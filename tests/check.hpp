@@ -0,0 +1,34 @@
+#pragma once
+
+/*
+ * Minimal checks of the tests that are built with RUN_TESTS: a failed CHECK is reported and
+ * counted, and main returns PlotMsgTest::result() such that ctest fails the test.
+ */
+#include <iostream>
+
+namespace PlotMsgTest
+{
+    inline int &failures()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    inline int result()
+    {
+        if (failures() > 0)
+            std::cerr << failures() << " check(s) failed" << std::endl;
+        return failures() > 0 ? 1 : 0;
+    }
+}  // namespace PlotMsgTest
+
+#define CHECK(condition)                                                                       \
+    do                                                                                         \
+    {                                                                                          \
+        if (!(condition))                                                                      \
+        {                                                                                      \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed"       \
+                      << std::endl;                                                            \
+            ++PlotMsgTest::failures();                                                         \
+        }                                                                                      \
+    } while (false)
@@ -0,0 +1,174 @@
+/*
+ * BoundedQueue on its own, and the queue of the background publisher (send_async) under each
+ * OverflowPolicy.
+ */
+#include "plotmsg/_impl/bounded_queue.hpp"
+#include "plotmsg/main.hpp"
+
+#include "check.hpp"
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    void test_fifo()
+    {
+        PlotMsg::BoundedQueue<int> queue(5);
+        CHECK(queue.capacity() == 8);
+
+        int value = -1;
+        CHECK(!queue.try_pop(value));
+        for (int i = 0; i < 8; ++i)
+        {
+            int item = i;
+            CHECK(queue.try_push(item));
+        }
+        int extra = 8;
+        CHECK(!queue.try_push(extra));
+        CHECK(queue.size_approx() == 8);
+        for (int i = 0; i < 8; ++i)
+        {
+            CHECK(queue.try_pop(value));
+            CHECK(value == i);
+        }
+        CHECK(!queue.try_pop(value));
+        CHECK(queue.size_approx() == 0);
+
+        // the positions wrap around the cells many times
+        for (int i = 0; i < 100; ++i)
+        {
+            int item = i;
+            CHECK(queue.try_push(item));
+            CHECK(queue.try_pop(value));
+            CHECK(value == i);
+        }
+    }
+
+    void test_rejected_push_keeps_value()
+    {
+        // drop_newest hands the rejected item back to its producer
+        PlotMsg::BoundedQueue<std::unique_ptr<int>> queue(2);
+        for (int i = 0; i < 2; ++i)
+        {
+            auto item = std::make_unique<int>(i);
+            CHECK(queue.try_push(item));
+            CHECK(item == nullptr);
+        }
+        auto rejected = std::make_unique<int>(2);
+        CHECK(!queue.try_push(rejected));
+        CHECK(rejected != nullptr && *rejected == 2);
+    }
+
+    void test_multiple_producers()
+    {
+        const int num_producers = 4;
+        const int per_producer = 10000;
+        PlotMsg::BoundedQueue<int> queue(16);
+
+        std::vector<std::thread> producers;
+        for (int p = 0; p < num_producers; ++p)
+        {
+            producers.emplace_back([&queue, p] {
+                for (int i = 0; i < per_producer; ++i)
+                {
+                    int item = p * per_producer + i;
+                    while (!queue.try_push(item))
+                        std::this_thread::yield();
+                }
+            });
+        }
+
+        // the items of each producer come out in the order it pushed them
+        std::vector<int> next(num_producers, 0);
+        int value;
+        for (int received = 0; received < num_producers * per_producer;)
+        {
+            if (!queue.try_pop(value))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            const int producer = value / per_producer;
+            CHECK(value % per_producer == next[producer]);
+            next[producer] = value % per_producer + 1;
+            ++received;
+        }
+        for (auto &&producer : producers)
+            producer.join();
+        for (int p = 0; p < num_producers; ++p)
+            CHECK(next[p] == per_producer);
+        CHECK(!queue.try_pop(value));
+    }
+
+    PlotMsg::MessagePtr<PlotMsg::MessageContainer> large_figure(const std::string &uuid)
+    {
+        // takes a while to encode, such that the queue of two fills up
+        PlotMsg::MessagePtr<PlotMsg::MessageContainer> msg(new PlotMsg::MessageContainer());
+        msg->mutable_fig()->set_uuid(uuid);
+        auto &data = *msg->mutable_fig()->add_traces()->mutable_kwargs()->mutable_data();
+        PlotMsg::_set_DictItemVal(data["x"], std::vector<double>(1 << 18, 1.5));
+        return msg;
+    }
+
+    void test_overflow_policy(PlotMsg::OverflowPolicy policy, const std::string &uuid)
+    {
+        PlotMsg::static_publisher_options.async_overflow_policy = policy;
+        PlotMsg::reset_stats();
+
+        const size_t num_messages = 16;
+        std::vector<std::future<bool>> sent;
+        for (size_t i = 0; i < num_messages; ++i)
+            sent.push_back(
+                PlotMsg::publish_message_async(large_figure(uuid), nullptr, zmq::send_flags::none)
+            );
+        CHECK(PlotMsg::flush(std::chrono::seconds(60)));
+
+        // every message is either published or dropped, and counted as such
+        std::vector<bool> published;
+        for (auto &&future : sent)
+        {
+            CHECK(future.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+            published.push_back(future.get());
+        }
+        const size_t num_published = std::count(published.begin(), published.end(), true);
+        const auto stats = PlotMsg::stats();
+        CHECK(stats.total.frames_sent == num_published);
+        CHECK(stats.total.frames_dropped == num_messages - num_published);
+        CHECK(stats.queue_depth == 0);
+
+        switch (policy)
+        {
+            case PlotMsg::OverflowPolicy::block:
+                CHECK(num_published == num_messages);
+                break;
+            case PlotMsg::OverflowPolicy::drop_newest:
+                // the queue is empty when the first message is pushed
+                CHECK(published.front());
+                break;
+            case PlotMsg::OverflowPolicy::drop_oldest:
+                // nothing is pushed after the last message
+                CHECK(published.back());
+                break;
+        }
+    }
+}  // namespace
+
+int main()
+{
+    test_fifo();
+    test_rejected_push_keeps_value();
+    test_multiple_producers();
+
+    // read when the publisher thread starts, with the first message
+    PlotMsg::static_publisher_options.async_queue_size = 2;
+    PlotMsg::initialise_publisher(0, "inproc://plotmsg-test-bounded-queue");
+    test_overflow_policy(PlotMsg::OverflowPolicy::block, "block");
+    test_overflow_policy(PlotMsg::OverflowPolicy::drop_newest, "drop_newest");
+    test_overflow_policy(PlotMsg::OverflowPolicy::drop_oldest, "drop_oldest");
+    return PlotMsgTest::result();
+}
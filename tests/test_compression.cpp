@@ -0,0 +1,180 @@
+/*
+ * Compressed payloads (PublisherOptions::compression_codec): the header and chunks of the
+ * payload frame, which are decompressed again with the codecs that the test is built with.
+ */
+#include "plotmsg/main.hpp"
+
+#include "check.hpp"
+
+#include <google/protobuf/util/message_differencer.h>
+
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef WITH_LZ4
+#include <lz4.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using PlotMsg::Codec;
+    using PlotMsg::MessageContainer;
+
+    template <typename T>
+    T load_le(const char *in)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < sizeof(T); ++i)
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+        return static_cast<T>(value);
+    }
+
+    MessageContainer figure(const std::vector<double> &y)
+    {
+        MessageContainer msg;
+        msg.mutable_fig()->set_uuid("compression");
+        auto &data = *msg.mutable_fig()->add_traces()->mutable_kwargs()->mutable_data();
+        PlotMsg::_set_DictItemVal(data["y"], y);
+        return msg;
+    }
+
+    // decompresses a chunk, returns false if the codec is not built into the test
+    bool decompress_chunk(Codec codec, const char *src, size_t size, char *dst, size_t raw_size)
+    {
+        switch (codec)
+        {
+#ifdef WITH_ZSTD
+            case Codec::zstd:
+                CHECK(ZSTD_decompress(dst, raw_size, src, size) == raw_size);
+                return true;
+#endif
+#ifdef WITH_LZ4
+            case Codec::lz4:
+                CHECK(LZ4_decompress_safe(src, dst, int(size), int(raw_size)) == int(raw_size));
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+    void test_round_trip(Codec codec, size_t chunk_size)
+    {
+        std::vector<double> y(1 << 17);
+        for (size_t i = 0; i < y.size(); ++i)
+            y[i] = i % 100;
+        const auto original = figure(y);
+        const size_t raw_size = original.ByteSizeLong();
+
+        auto msg = original;
+        PlotMsg::static_publisher_options.compression_chunk_size = chunk_size;
+        std::vector<zmq::message_t> frames;
+        try
+        {
+            frames = PlotMsg::encode_message(msg);
+        }
+        catch (const std::invalid_argument &)
+        {
+            std::cerr << "codec " << int(codec) << " is not built into plotmsg, skipped"
+                      << std::endl;
+            return;
+        }
+        CHECK(frames.size() == 1);
+        const char *frame = frames[0].data<char>();
+        const size_t frame_size = frames[0].size();
+        CHECK(frame_size < raw_size);
+
+        // uint8 0, uint8 codec, uint16 0, uint32 num_chunks, uint64 raw_size, uint32 chunk_size
+        const size_t header_size = 20;
+        CHECK(frame_size >= header_size);
+        CHECK(frame[0] == 0 && frame[1] == char(codec) && frame[2] == 0 && frame[3] == 0);
+        const uint32_t num_chunks = load_le<uint32_t>(frame + 4);
+        CHECK(num_chunks == (raw_size + chunk_size - 1) / chunk_size);
+        CHECK(load_le<uint64_t>(frame + 8) == raw_size);
+        CHECK(load_le<uint32_t>(frame + 16) == chunk_size);
+
+        // followed by the size of each chunk, and the chunks
+        size_t offset = header_size + num_chunks * sizeof(uint32_t);
+        CHECK(offset <= frame_size);
+        std::string payload(raw_size, '\0');
+        bool decompressed = true;
+        for (uint32_t i = 0; i < num_chunks && offset <= frame_size; ++i)
+        {
+            const uint32_t size = load_le<uint32_t>(frame + header_size + i * sizeof(uint32_t));
+            CHECK(size <= frame_size - offset);
+            const size_t raw_offset = i * chunk_size;
+            decompressed &= decompress_chunk(
+                codec, frame + offset, size, &payload[raw_offset],
+                std::min(chunk_size, raw_size - raw_offset)
+            );
+            offset += size;
+        }
+        CHECK(offset == frame_size);
+
+        if (decompressed)
+        {
+            MessageContainer received;
+            CHECK(received.ParseFromString(payload));
+            CHECK(google::protobuf::util::MessageDifferencer::Equals(received, original));
+        }
+
+        // the chunks do not depend on the threads that compress them
+        PlotMsg::static_publisher_options.compression_threads = 1;
+        msg = original;
+        auto serial = PlotMsg::encode_message(msg);
+        PlotMsg::static_publisher_options.compression_threads = 0;
+        CHECK(serial[0].size() == frame_size);
+        CHECK(std::memcmp(serial[0].data(), frame, frame_size) == 0);
+    }
+
+    void test_sent_raw()
+    {
+        // payloads below compression_threshold, and those that do not get smaller
+        auto small = figure({1, 2, 3});
+        auto frames = PlotMsg::encode_message(small);
+        CHECK(frames[0].size() == figure({1, 2, 3}).ByteSizeLong());
+        CHECK(frames[0].data<char>()[0] != 0);
+
+        std::mt19937_64 random(42);
+        std::vector<double> noise(1 << 15);
+        for (auto &&value : noise)
+        {
+            const uint64_t bits = random();
+            std::memcpy(&value, &bits, sizeof(value));
+        }
+        auto incompressible = figure(noise);
+        const auto expected = incompressible.SerializeAsString();
+        try
+        {
+            frames = PlotMsg::encode_message(incompressible);
+        }
+        catch (const std::invalid_argument &)
+        {
+            return;
+        }
+        CHECK(frames[0].size() == expected.size());
+        CHECK(std::memcmp(frames[0].data(), expected.data(), expected.size()) == 0);
+    }
+}  // namespace
+
+int main()
+{
+    PlotMsg::static_publisher_options.compression_threshold = 1024;
+    for (Codec codec : {Codec::zstd, Codec::lz4})
+    {
+        PlotMsg::static_publisher_options.compression_codec = codec;
+        // a single chunk, several chunks and a short last chunk
+        test_round_trip(codec, 1 << 22);
+        test_round_trip(codec, 1 << 16);
+        test_round_trip(codec, 100000);
+        test_sent_raw();
+    }
+    return PlotMsgTest::result();
+}
@@ -0,0 +1,151 @@
+/*
+ * Deduplication of series (PublisherOptions::dedup_series): the series that occur more than
+ * once are sent once in the series table, and referred to by index from each occurrence.
+ */
+#include "plotmsg/main.hpp"
+
+#include "check.hpp"
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using google::protobuf::util::MessageDifferencer;
+    using PlotMsg::DictItemValMsg;
+    using PlotMsg::MessageContainer;
+
+    const DictItemValMsg &item(const MessageContainer &msg, int trace, const std::string &key)
+    {
+        return msg.fig().traces(trace).kwargs().data().at(key);
+    }
+
+    // the bytes of the frame that a series (in the payload or the series table) refers to
+    std::string frame_of(const DictItemValMsg &value, const std::vector<zmq::message_t> &frames)
+    {
+        CHECK(value.has_series_frame());
+        const size_t frame = 1 + value.series_frame().frame();
+        CHECK(frame < frames.size());
+        return frame < frames.size() ? frames[frame].to_string() : std::string();
+    }
+
+    struct Encoded
+    {
+        MessageContainer original;
+        MessageContainer received;
+        std::vector<zmq::message_t> frames;
+    };
+
+    Encoded encode(const std::vector<double> &x, const PlotMsg::SharedSeries &shared)
+    {
+        Encoded encoded;
+        auto &fig = *encoded.original.mutable_fig();
+        fig.set_uuid("dedup");
+        const std::vector<int32_t> int_zeros(1024, 0);
+        const std::vector<float> float_zeros(1024, 0);
+        std::vector<double> other_x = x;
+        other_x.back() += 1;
+        // held until the message is encoded, like every shared series that it refers to
+        const auto same_content = PlotMsg::shared_series(x);
+        for (int t = 0; t < 3; ++t)
+        {
+            auto &data = *fig.add_traces()->mutable_kwargs()->mutable_data();
+            // the same x in the first two traces, and another x (of the same size) in the last
+            PlotMsg::_set_DictItemVal(data["x"], t < 2 ? x : other_x);
+            // below dedup_min_bytes
+            PlotMsg::_set_DictItemVal(data["y"], std::vector<double>{1, 2, 3});
+            // the same bytes, but not the same dtype
+            if (t == 0)
+                PlotMsg::_set_DictItemVal(data["a"], PlotMsg::ndarray(int_zeros, {1024}));
+            else
+                PlotMsg::_set_DictItemVal(data["a"], PlotMsg::ndarray(float_zeros, {1024}));
+            // shared series are told apart by identity, not by content
+            if (t == 1)
+                PlotMsg::_set_DictItemVal(data["s"], same_content);
+            else
+                PlotMsg::_set_DictItemVal(data["s"], shared);
+        }
+
+        auto msg = encoded.original;
+        encoded.frames = PlotMsg::encode_message(msg);
+        CHECK(encoded.received.ParseFromArray(
+            encoded.frames[0].data(), static_cast<int>(encoded.frames[0].size())
+        ));
+        return encoded;
+    }
+
+    void test_dedup()
+    {
+        std::vector<double> x(512);
+        for (size_t i = 0; i < x.size(); ++i)
+            x[i] = 0.5 * i;
+        const auto shared = PlotMsg::shared_series(x);
+        const auto encoded = encode(x, shared);
+        const auto &received = encoded.received;
+        const auto &frames = encoded.frames;
+
+        // the payload and the frames of the two distinct shared series
+        CHECK(frames.size() == 3);
+        // x, the float zeros of the last two traces and the shared series
+        CHECK(received.series_table_size() == 3);
+        if (received.series_table_size() != 3)
+            return;
+
+        const auto &x0 = item(received, 0, "x");
+        const auto &x1 = item(received, 1, "x");
+        CHECK(x0.has_series_ref() && x1.has_series_ref());
+        CHECK(x0.series_ref() == x1.series_ref());
+        CHECK(MessageDifferencer::Equals(
+            received.series_table(x0.series_ref()), item(encoded.original, 0, "x")
+        ));
+        CHECK(MessageDifferencer::Equals(item(received, 2, "x"), item(encoded.original, 2, "x")));
+
+        for (int t = 0; t < 3; ++t)
+        {
+            const auto &y = item(received, t, "y");
+            CHECK(MessageDifferencer::Equals(y, item(encoded.original, t, "y")));
+        }
+        CHECK(MessageDifferencer::Equals(item(received, 0, "a"), item(encoded.original, 0, "a")));
+        const auto &a1 = item(received, 1, "a");
+        CHECK(a1.has_series_ref() && a1.series_ref() == item(received, 2, "a").series_ref());
+        CHECK(MessageDifferencer::Equals(
+            received.series_table(a1.series_ref()), item(encoded.original, 1, "a")
+        ));
+
+        const auto &s0 = item(received, 0, "s");
+        const auto &s2 = item(received, 2, "s");
+        CHECK(s0.has_series_ref() && s2.has_series_ref());
+        CHECK(s0.series_ref() == s2.series_ref());
+        const std::string x_bytes(reinterpret_cast<const char *>(x.data()), x.size() * 8);
+        CHECK(frame_of(received.series_table(s0.series_ref()), frames) == x_bytes);
+        CHECK(frame_of(item(received, 1, "s"), frames) == x_bytes);
+    }
+
+    void test_min_bytes()
+    {
+        // every repeated series is sent once without a minimum size
+        PlotMsg::static_publisher_options.dedup_min_bytes = 0;
+        const std::vector<double> x{1, 2, 3, 4};
+        const auto encoded = encode(x, PlotMsg::shared_series(x));
+        const auto &received = encoded.received;
+        // x, y, the float zeros and the shared series
+        CHECK(received.series_table_size() == 4);
+        for (int t = 0; t < 3; ++t)
+            CHECK(item(received, t, "y").has_series_ref());
+        CHECK(item(received, 0, "y").series_ref() == item(received, 2, "y").series_ref());
+        CHECK(item(received, 0, "x").series_ref() == item(received, 1, "x").series_ref());
+        CHECK(!item(received, 2, "x").has_series_ref());
+        PlotMsg::static_publisher_options.dedup_min_bytes = 1024;
+    }
+}  // namespace
+
+int main()
+{
+    PlotMsg::static_publisher_options.dedup_series = true;
+    test_dedup();
+    test_min_bytes();
+    return PlotMsgTest::result();
+}
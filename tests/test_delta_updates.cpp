@@ -0,0 +1,163 @@
+/*
+ * Delta updates (PublisherOptions::delta_updates): the patches of a figure, applied the way the
+ * subscriber does on top of the last frame, have to give the whole frame again.
+ */
+#include "plotmsg/main.hpp"
+
+#include "check.hpp"
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include <string>
+#include <vector>
+
+namespace
+{
+    using PlotMsg::MessageContainer;
+    using PlotMsg::PlotlyFigureMsg;
+
+    // the figures that the subscriber builds from the messages it receives
+    PlotlyFigureMsg s_state;
+
+    MessageContainer figure(const std::vector<std::vector<double>> &ys, bool with_mode = true)
+    {
+        MessageContainer msg;
+        msg.mutable_fig()->set_uuid("delta");
+        for (auto &&y : ys)
+        {
+            auto &data = *msg.mutable_fig()->add_traces()->mutable_kwargs()->mutable_data();
+            PlotMsg::_set_DictItemVal(data["x"], std::vector<double>(y.size(), 0.5));
+            PlotMsg::_set_DictItemVal(data["y"], y);
+            if (with_mode)
+                PlotMsg::_set_DictItemVal(data["mode"], std::vector<std::string>{"lines"});
+        }
+        return msg;
+    }
+
+    // applies a received figure the way the subscriber does, a patch only on top of a state
+    // with the same traces (returns false if it was dropped for lack of one)
+    bool apply(PlotlyFigureMsg &state, const PlotlyFigureMsg &fig)
+    {
+        if (!fig.patch())
+        {
+            state = fig;
+            return true;
+        }
+        if (fig.traces_size() != state.traces_size())
+            return false;
+        for (int i = 0; i < fig.traces_size(); ++i)
+        {
+            auto &stored = *state.mutable_traces(i)->mutable_kwargs()->mutable_data();
+            for (auto &&kv_pair : fig.traces(i).kwargs().data())
+                stored[kv_pair.first] = kv_pair.second;
+        }
+        return true;
+    }
+
+    // encode and decode msg, and apply it to s_state, returns the decoded message
+    MessageContainer round_trip(MessageContainer msg)
+    {
+        auto frames = PlotMsg::encode_message(msg);
+        CHECK(frames.size() == 1);
+        MessageContainer received;
+        CHECK(received.ParseFromArray(frames[0].data(), static_cast<int>(frames[0].size())));
+        CHECK(apply(s_state, received.fig()));
+        return received;
+    }
+
+    bool state_is(const MessageContainer &expected, PlotlyFigureMsg state = s_state)
+    {
+        state.set_patch(false);
+        return google::protobuf::util::MessageDifferencer::Equals(state, expected.fig());
+    }
+
+    size_t num_keys(const MessageContainer &msg, int trace)
+    {
+        return msg.fig().traces(trace).kwargs().data().size();
+    }
+
+    void test_patches()
+    {
+        auto first = figure({{1, 2, 3}, {4, 5, 6}});
+        auto received = round_trip(first);
+        CHECK(!received.fig().patch());
+        CHECK(state_is(first));
+
+        // only the changed y of the second trace is sent
+        auto second = figure({{1, 2, 3}, {4, 5, 7}});
+        received = round_trip(second);
+        CHECK(received.fig().patch());
+        CHECK(num_keys(received, 0) == 0);
+        CHECK(num_keys(received, 1) == 1 && received.fig().traces(1).kwargs().data().count("y"));
+        CHECK(state_is(second));
+
+        // an unchanged frame is an empty patch
+        received = round_trip(second);
+        CHECK(received.fig().patch());
+        CHECK(num_keys(received, 0) == 0 && num_keys(received, 1) == 0);
+        CHECK(state_is(second));
+
+        // a series with the same size whose bytes differ (e.g. -0.0 and 0.0) is sent
+        auto signed_zero = figure({{1, 2, 3}, {4, 5, -0.0}});
+        auto zero = figure({{1, 2, 3}, {4, 5, 0.0}});
+        round_trip(signed_zero);
+        received = round_trip(zero);
+        CHECK(received.fig().patch());
+        CHECK(num_keys(received, 1) == 1);
+        CHECK(state_is(zero));
+
+        // a removed key cannot be patched
+        auto without_mode = figure({{1, 2, 3}, {4, 5, 0.0}}, false);
+        received = round_trip(without_mode);
+        CHECK(!received.fig().patch());
+        CHECK(state_is(without_mode));
+
+        // nor can a trace that was added, or recreated with another method
+        auto three_traces = figure({{1, 2, 3}, {4, 5, 0.0}, {7}});
+        received = round_trip(three_traces);
+        CHECK(!received.fig().patch());
+        CHECK(state_is(three_traces));
+
+        auto recreated = three_traces;
+        recreated.mutable_fig()->mutable_traces(2)->set_method_func("Bar");
+        received = round_trip(recreated);
+        CHECK(!received.fig().patch());
+        CHECK(state_is(recreated));
+    }
+
+    void test_keyframes()
+    {
+        // every delta_keyframe_interval-th frame is whole, for subscribers that joined late
+        PlotMsg::static_publisher_options.delta_keyframe_interval = 3;
+        std::vector<bool> patches;
+        for (int i = 0; i < 7; ++i)
+        {
+            auto frame = figure({{1, 2, double(i)}});
+            patches.push_back(round_trip(frame).fig().patch());
+            CHECK(state_is(frame));
+        }
+        // the first frame after the last test is whole (its trace count changed)
+        const std::vector<bool> expected{false, true, true, false, true, true, false};
+        CHECK(patches == expected);
+
+        // a subscriber that joins late drops the patches until the next keyframe, from which
+        // on it is in sync
+        PlotlyFigureMsg late;
+        std::vector<bool> applied;
+        for (int i = 7; i < 12; ++i)
+        {
+            auto frame = figure({{1, 2, double(i)}});
+            applied.push_back(apply(late, round_trip(frame).fig()));
+            CHECK(!applied.back() || state_is(frame, late));
+        }
+        CHECK(applied == (std::vector<bool>{false, false, true, true, true}));
+    }
+}  // namespace
+
+int main()
+{
+    PlotMsg::static_publisher_options.delta_updates = true;
+    test_patches();
+    test_keyframes();
+    return PlotMsgTest::result();
+}
@@ -0,0 +1,126 @@
+/*
+ * Figure::extend_trace: the extends of a figure, appended by the subscriber to the last frame
+ * (keeping max_points samples), and the whole frame that has to follow them with delta_updates.
+ * The messages are published into a recording (record_only), from which they are read back.
+ */
+#include "plotmsg/main.hpp"
+#include "plotmsg/template/core.hpp"
+
+#include "check.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using PlotMsg::MessageContainer;
+    using PlotMsg::PlotlyFigureMsg;
+
+    const char *s_record_path = "test_extend.plotmsg";
+
+    // the figures that were published so far, in order
+    std::vector<PlotlyFigureMsg> published()
+    {
+        PlotMsg::flush_recording();
+        std::ifstream file(s_record_path, std::ios::binary);
+        const std::string log{std::istreambuf_iterator<char>(file), {}};
+        std::vector<PlotlyFigureMsg> figures;
+        for (auto &&record : PlotMsg::parse_record_log(log.data(), log.size()))
+        {
+            CHECK(record.frames.size() == 1);
+            MessageContainer msg;
+            CHECK(msg.ParseFromArray(record.frames[0].first, record.frames[0].second));
+            figures.push_back(msg.fig());
+        }
+        return figures;
+    }
+
+    // the subscriber's state of a figure after fig, see PlotMsgPlotly._extend_series
+    void apply(PlotlyFigureMsg &state, const PlotlyFigureMsg &fig)
+    {
+        if (fig.extends_size() == 0)
+        {
+            CHECK(!fig.patch());
+            state = fig;
+            return;
+        }
+        for (auto &&extend : fig.extends())
+        {
+            auto &kwargs = *state.mutable_traces(extend.trace())->mutable_kwargs()->mutable_data();
+            for (auto &&kv_pair : extend.data().data())
+            {
+                auto &series = *kwargs[kv_pair.first].mutable_series_d()->mutable_data();
+                series.MergeFrom(kv_pair.second.series_d().data());
+                if (extend.max_points() > 0 && series.size() > int(extend.max_points()))
+                    series.erase(series.begin(), series.end() - extend.max_points());
+            }
+        }
+    }
+
+    std::vector<double> series(const PlotlyFigureMsg &state, const std::string &key)
+    {
+        const auto &data = state.traces(0).kwargs().data().at(key).series_d().data();
+        return {data.begin(), data.end()};
+    }
+}  // namespace
+
+int main()
+{
+    std::remove(s_record_path);
+    PlotMsg::static_publisher_options.record_path = s_record_path;
+    PlotMsg::static_publisher_options.record_only = true;
+    // the frame after an extend has to be whole, even though it is the same as before
+    PlotMsg::static_publisher_options.delta_updates = true;
+    PlotMsg::initialise_publisher(0, "inproc://plotmsg-test-extend");
+
+    PlotMsg::Figure fig("extend");
+    auto send_whole = [&fig] {
+        fig.add_trace(PlotMsg::TraceTemplate::scatter(
+            std::vector<double>{0, 1, 2}, std::vector<double>{10, 11, 12}
+        ));
+        fig.send();
+    };
+    send_whole();
+
+    // only the new samples are sent, with the max_points of the last extend_trace of the trace
+    fig.extend_trace(0, "x", std::vector<double>{3, 4}, 100);
+    fig.extend_trace(0, "y", std::vector<double>{13, 14}, 4);
+    fig.send();
+    fig.extend_trace(0, "x", std::vector<double>{5});
+    fig.send();
+    send_whole();
+
+    const auto figures = published();
+    CHECK(figures.size() == 4);
+    if (figures.size() != 4)
+        return PlotMsgTest::result();
+
+    const auto &extends = figures[1].extends();
+    CHECK(figures[1].traces_size() == 0);
+    CHECK(extends.size() == 1);
+    CHECK(extends[0].trace() == 0 && extends[0].max_points() == 4);
+    CHECK(extends[0].data().data().size() == 2);
+
+    PlotlyFigureMsg state;
+    apply(state, figures[0]);
+    apply(state, figures[1]);
+    CHECK(series(state, "x") == (std::vector<double>{1, 2, 3, 4}));
+    CHECK(series(state, "y") == (std::vector<double>{11, 12, 13, 14}));
+
+    // max_points of 0 keeps every sample
+    CHECK(figures[2].extends_size() == 1 && figures[2].extends(0).max_points() == 0);
+    apply(state, figures[2]);
+    CHECK(series(state, "x") == (std::vector<double>{1, 2, 3, 4, 5}));
+    CHECK(series(state, "y") == (std::vector<double>{11, 12, 13, 14}));
+
+    // rather than a patch without any key, which would keep the extended series
+    CHECK(!figures[3].patch());
+    apply(state, figures[3]);
+    CHECK(series(state, "x") == (std::vector<double>{0, 1, 2}));
+
+    std::remove(s_record_path);
+    return PlotMsgTest::result();
+}
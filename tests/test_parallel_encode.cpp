@@ -0,0 +1,98 @@
+/*
+ * Parallel serialisation of the traces of a figure (PublisherOptions::parallel_encode_threads):
+ * the stitched payload has to decode to the same message as the serial one.
+ */
+#include "plotmsg/main.hpp"
+
+#include "check.hpp"
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include <string>
+#include <vector>
+
+namespace
+{
+    using google::protobuf::util::MessageDifferencer;
+    using PlotMsg::MessageContainer;
+
+    MessageContainer figure(int num_traces)
+    {
+        MessageContainer msg;
+        auto &fig = *msg.mutable_fig();
+        fig.set_uuid("parallel");
+        for (int t = 0; t < num_traces; ++t)
+        {
+            auto &trace = *fig.add_traces();
+            trace.set_method_func(t % 2 ? "Scatter" : "Bar");
+            auto &data = *trace.mutable_kwargs()->mutable_data();
+            // traces of different sizes, such that their records are not all alike
+            std::vector<double> y(100 * (t + 1));
+            for (size_t i = 0; i < y.size(); ++i)
+                y[i] = t + 0.001 * i;
+            PlotMsg::_set_DictItemVal(data["y"], y);
+            PlotMsg::_set_DictItemVal(data["name"], "trace " + std::to_string(t));
+        }
+        // the rest of the figure is written by the calling thread
+        auto &command = *fig.add_commands();
+        command.set_func("update_layout");
+        auto &kwargs = *command.mutable_kwargs()->mutable_data();
+        PlotMsg::_set_DictItemVal(kwargs["title"], "parallel");
+        return msg;
+    }
+
+    std::string encode(MessageContainer msg, size_t threads)
+    {
+        PlotMsg::static_publisher_options.parallel_encode_threads = threads;
+        auto frames = PlotMsg::encode_message(msg);
+        CHECK(frames.size() == 1);
+        return frames[0].to_string();
+    }
+
+    void test_same_message(int num_traces)
+    {
+        const auto original = figure(num_traces);
+        const auto serial = encode(original, 1);
+        MessageContainer received;
+        CHECK(received.ParseFromString(serial));
+        CHECK(MessageDifferencer::Equals(received, original));
+
+        for (size_t threads : {2, 3, 8, 0})
+        {
+            const auto parallel = encode(original, threads);
+            received.Clear();
+            CHECK(received.ParseFromString(parallel));
+            CHECK(MessageDifferencer::Equals(received, original));
+            // every trace is wrapped into a record of its own (0 uses every core, which might
+            // be a single one)
+            CHECK(num_traces < 2 || threads == 0 || parallel.size() > serial.size());
+            for (int t = 0; t < received.fig().traces_size(); ++t)
+                CHECK(received.fig().traces(t).kwargs().data().at("name").string() ==
+                      "trace " + std::to_string(t));
+        }
+    }
+
+    void test_arena()
+    {
+        // the traces are moved aside on the arena of the message, and back after serialising
+        google::protobuf::Arena arena;
+        auto *msg = google::protobuf::Arena::CreateMessage<MessageContainer>(&arena);
+        const auto original = figure(16);
+        msg->CopyFrom(original);
+        PlotMsg::static_publisher_options.parallel_encode_threads = 4;
+        auto frames = PlotMsg::encode_message(*msg);
+        MessageContainer received;
+        CHECK(received.ParseFromArray(frames[0].data(), static_cast<int>(frames[0].size())));
+        CHECK(MessageDifferencer::Equals(received, original));
+        CHECK(MessageDifferencer::Equals(*msg, original));
+    }
+}  // namespace
+
+int main()
+{
+    PlotMsg::static_publisher_options.parallel_encode_threshold = 0;
+    for (int num_traces : {0, 1, 2, 7, 64})
+        test_same_message(num_traces);
+    test_arena();
+    return PlotMsgTest::result();
+}
@@ -0,0 +1,178 @@
+/*
+ * Recordings (PublisherOptions::record_path): parse_record_log on handcrafted logs, also when
+ * they are truncated or corrupt, and the records that a publisher appends to a recording.
+ */
+#include "plotmsg/main.hpp"
+
+#include "check.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const char *s_record_path = "test_record_log.plotmsg";
+
+    template <typename T>
+    void append_le(std::string &out, T value)
+    {
+        for (size_t i = 0; i < sizeof(T); ++i)
+            out.push_back(static_cast<char>(static_cast<uint64_t>(value) >> (8 * i)));
+    }
+
+    std::string
+    record(int64_t time_ns, const std::string &uuid, const std::vector<std::string> &frames)
+    {
+        std::string body;
+        append_le(body, time_ns);
+        append_le(body, static_cast<uint32_t>(uuid.size()));
+        append_le(body, static_cast<uint32_t>(frames.size()));
+        body += uuid;
+        for (auto &&frame : frames)
+        {
+            append_le(body, static_cast<uint64_t>(frame.size()));
+            body += frame;
+        }
+        std::string out;
+        append_le(out, static_cast<uint64_t>(body.size()));
+        return out + body;
+    }
+
+    const std::string s_magic(PlotMsg::record_log_magic, sizeof(PlotMsg::record_log_magic));
+    const std::string s_first = record(-5, "fig", {"payload", ""});
+    const std::string s_second = record(int64_t(1) << 40, "", {std::string("\0\1\2", 3)});
+
+    bool throws(const std::string &log)
+    {
+        try
+        {
+            PlotMsg::parse_record_log(log.data(), log.size());
+        }
+        catch (const std::runtime_error &)
+        {
+            return true;
+        }
+        return false;
+    }
+
+    void test_parse()
+    {
+        const std::string log = s_magic + s_first + s_second;
+        const auto records = PlotMsg::parse_record_log(log.data(), log.size());
+        CHECK(records.size() == 2);
+        if (records.size() != 2)
+            return;
+        CHECK(records[0].time_ns == -5 && records[0].uuid == "fig");
+        CHECK(records[0].frames.size() == 2);
+        CHECK(std::string(records[0].frames[0].first, records[0].frames[0].second) == "payload");
+        CHECK(records[0].frames[1].second == 0);
+        CHECK(records[1].time_ns == int64_t(1) << 40 && records[1].uuid.empty());
+        CHECK(records[1].frames.size() == 1);
+        CHECK(std::string(records[1].frames[0].first, records[1].frames[0].second) ==
+              std::string("\0\1\2", 3));
+        // the frames view the log
+        CHECK(records[1].frames[0].first == log.data() + log.size() - 3);
+    }
+
+    void test_truncated()
+    {
+        // a record that is still written is left out, at whichever byte the log ends
+        const std::string log = s_magic + s_first + s_second;
+        for (size_t size = s_magic.size(); size <= log.size(); ++size)
+        {
+            size_t expected = 0;
+            if (size >= s_magic.size() + s_first.size())
+                ++expected;
+            if (size == log.size())
+                ++expected;
+            try
+            {
+                CHECK(PlotMsg::parse_record_log(log.data(), size).size() == expected);
+            }
+            catch (const std::runtime_error &)
+            {
+                CHECK(false);
+            }
+        }
+    }
+
+    void test_corrupt()
+    {
+        CHECK(throws(""));
+        CHECK(throws(s_magic.substr(0, 4)));
+        CHECK(throws("PMSGLOG0" + s_first));
+        CHECK(!throws(s_magic));
+
+        // lengths within a complete record that point beyond it
+        auto corrupt = [](size_t offset, uint32_t value) {
+            std::string log = s_magic + s_first + s_second;
+            std::string field;
+            append_le(field, value);
+            log.replace(s_magic.size() + offset, field.size(), field);
+            return log;
+        };
+        // uuid_size, num_frames and the size of the first frame
+        CHECK(throws(corrupt(16, 1000)));
+        CHECK(throws(corrupt(16, 0xffffffff)));
+        CHECK(throws(corrupt(20, 3)));
+        CHECK(throws(corrupt(20, 0xffffffff)));
+        CHECK(throws(corrupt(24 + 3, 1000)));
+        // frames that do not fill the record
+        CHECK(throws(corrupt(20, 1)));
+        // a record size below the header
+        CHECK(throws(corrupt(0, 4)));
+    }
+
+    std::string read_log()
+    {
+        std::ifstream file(s_record_path, std::ios::binary);
+        return {std::istreambuf_iterator<char>(file), {}};
+    }
+
+    void test_append()
+    {
+        // a recording of a publisher that crashed while writing its last record is cut
+        // behind its last complete record, and appended to
+        {
+            std::ofstream file(s_record_path, std::ios::binary | std::ios::trunc);
+            file << s_magic << s_first << s_second.substr(0, s_second.size() - 1);
+        }
+        PlotMsg::static_publisher_options.record_path = s_record_path;
+        PlotMsg::static_publisher_options.record_only = true;
+        PlotMsg::initialise_publisher(0, "inproc://plotmsg-test-record-log");
+
+        PlotMsg::Figure fig("appended");
+        fig.add_trace(PlotMsg::Trace(PlotMsgProto::PlotlyTrace::graph_objects, "Scatter"));
+        fig.send();
+        PlotMsg::flush_recording();
+
+        const auto log = read_log();
+        const auto records = PlotMsg::parse_record_log(log.data(), log.size());
+        CHECK(records.size() == 2);
+        if (records.size() != 2)
+            return;
+        CHECK(records[0].uuid == "fig");
+        CHECK(records[1].uuid == "appended");
+        CHECK(records[1].time_ns > 0 && records[1].frames.size() == 1);
+        PlotMsg::MessageContainer msg;
+        CHECK(msg.ParseFromArray(records[1].frames[0].first, int(records[1].frames[0].second)));
+        CHECK(msg.fig().uuid() == "appended" && msg.fig().traces_size() == 1);
+        // nothing follows the new record
+        const auto &frame = records[1].frames[0];
+        CHECK(frame.first + frame.second == log.data() + log.size());
+    }
+}  // namespace
+
+int main()
+{
+    test_parse();
+    test_truncated();
+    test_corrupt();
+    test_append();
+    std::remove(s_record_path);
+    return PlotMsgTest::result();
+}
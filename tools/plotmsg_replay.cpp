@@ -0,0 +1,169 @@
+/*
+ * Publish the messages of a recording (see PublisherOptions::record_path) again, with their
+ * original timing.
+ *
+ * Usage: plotmsg_replay <log> [--addr=<addr>] [--speed=<factor>] [--from=<s>] [--to=<s>]
+ *                       [--uuid=<uuid>] [--list]
+ *
+ * --speed scales the time between messages (2 replays twice as fast), and 0 publishes them
+ * as fast as possible. --from and --to select the messages by their time (in seconds) since
+ * the first message of the recording, and --uuid only replays the figures of that uuid (an
+ * empty uuid selects the dictionaries). --list prints the selected messages instead.
+ */
+#include "plotmsg/main.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        std::string path;
+        std::string addr = PLOTMSG_DEFAULT_ADDR;
+        double speed = 1;
+        double from_s = 0;
+        double to_s = -1;
+        bool filter_uuid = false;
+        std::string uuid;
+        bool list = false;
+    };
+
+    Options options;
+
+    // the frames view the mapped log, which stays mapped until the process exits
+    void no_free(void * /* data */, void * /* hint */) {}
+
+    int replay(const std::vector<PlotMsg::RecordView> &records)
+    {
+        std::vector<const PlotMsg::RecordView *> selected;
+        const int64_t first_ns = records.empty() ? 0 : records.front().time_ns;
+        for (auto &&record : records)
+        {
+            const double t_s = (record.time_ns - first_ns) / 1e9;
+            if (t_s < options.from_s || (options.to_s >= 0 && t_s > options.to_s))
+                continue;
+            if (options.filter_uuid && record.uuid != options.uuid)
+                continue;
+            selected.push_back(&record);
+        }
+
+        if (options.list)
+        {
+            for (auto *record : selected)
+            {
+                size_t num_bytes = 0;
+                for (auto &&frame : record->frames)
+                    num_bytes += frame.second;
+                std::cout << std::fixed << std::setprecision(6) << std::setw(14)
+                          << (record->time_ns - first_ns) / 1e9 << std::setw(12) << num_bytes
+                          << "  " << (record->uuid.empty() ? "<dict>" : record->uuid)
+                          << std::endl;
+            }
+            return 0;
+        }
+        if (selected.empty())
+            return 0;
+
+        PlotMsg::initialise_publisher(1000, options.addr);
+        using clock = std::chrono::steady_clock;
+        const auto start = clock::now();
+        const int64_t start_ns = selected.front()->time_ns;
+        std::vector<zmq::message_t> frames;
+        for (auto *record : selected)
+        {
+            if (options.speed > 0)
+                std::this_thread::sleep_until(
+                    start + std::chrono::nanoseconds(
+                                static_cast<int64_t>((record->time_ns - start_ns) / options.speed)
+                            )
+                );
+            frames.clear();
+            for (auto &&frame : record->frames)
+                frames.emplace_back(
+                    const_cast<char *>(frame.first), frame.second, no_free, nullptr
+                );
+            PlotMsg::publish_frames(frames, zmq::send_flags::none);
+        }
+        std::cout << "replayed " << selected.size() << " messages in "
+                  << std::chrono::duration<double>(clock::now() - start).count() << " s"
+                  << std::endl;
+        return 0;
+    }
+}  // namespace
+
+int main(int argc, char const *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        auto value_of = [&arg](const char *flag) -> const char * {
+            const size_t len = std::strlen(flag);
+            return arg.compare(0, len, flag) == 0 ? arg.c_str() + len : nullptr;
+        };
+        if (arg == "--list")
+            options.list = true;
+        else if (auto value = value_of("--addr="))
+            options.addr = value;
+        else if (auto value = value_of("--speed="))
+            options.speed = std::atof(value);
+        else if (auto value = value_of("--from="))
+            options.from_s = std::atof(value);
+        else if (auto value = value_of("--to="))
+            options.to_s = std::atof(value);
+        else if (auto value = value_of("--uuid="))
+        {
+            options.filter_uuid = true;
+            options.uuid = value;
+        }
+        else if (arg.compare(0, 2, "--") != 0 && options.path.empty())
+            options.path = arg;
+        else
+            options.path.clear();
+    }
+    if (options.path.empty())
+    {
+        std::cerr << "usage: " << argv[0]
+                  << " <log> [--addr=<addr>] [--speed=<factor>] [--from=<s>] [--to=<s>]"
+                     " [--uuid=<uuid>] [--list]"
+                  << std::endl;
+        return 1;
+    }
+
+    const int fd = open(options.path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        std::cerr << "cannot open " << options.path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    const size_t size = static_cast<size_t>(info.st_size);
+    void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        std::cerr << "cannot map " << options.path << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        return replay(PlotMsg::parse_record_log(static_cast<const char *>(data), size));
+    }
+    catch (const std::runtime_error &error)
+    {
+        std::cerr << options.path << ": " << error.what() << std::endl;
+        return 1;
+    }
+}